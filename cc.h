@@ -0,0 +1,282 @@
+#ifndef __CC_H
+#define __CC_H
+
+// Control de congestión del servidor, uno por transferencia.
+// La ventana de congestión (cwnd) se mide en frames, igual que la ventana de ARQ,
+// y el ritmo de envío (pacing) en bytes por segundo. Cada algoritmo es una tabla
+// de funciones (CcOps), así que agregar otro no toca el camino de envío.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#define cc_initial_cwnd 10.0       // ventana inicial, como el IW10 de TCP
+#define cc_min_cwnd 2.0
+#define cc_bbr_bw_rounds 10        // rondas en las que se recuerda el máximo ancho de banda
+#define cc_bbr_rtt_window_us 10000000L // tiempo en el que se recuerda el mínimo RTT
+#define cc_bbr_startup_rounds 3    // rondas sin crecer 25% para salir del arranque
+
+typedef enum {
+    CC_LOSS_TIMEOUT,   // expiró el RTO
+    CC_LOSS_DUPACK     // acks duplicados: se perdió un frame pero siguen llegando otros
+}
+CcLoss;
+
+typedef enum {
+    CC_BBR_STARTUP,
+    CC_BBR_DRAIN,
+    CC_BBR_PROBE_BW
+}
+CcBbrPhase;
+
+typedef struct CcOps CcOps;
+
+// estado de congestión de una transferencia
+typedef struct {
+    const CcOps *ops;
+    size_t frame_bytes;        // bytes de un frame completo en la red
+    double max_cwnd;           // la ventana de ARQ: más frames que esos nunca están en vuelo
+    double cwnd;
+    double pacing_rate;        // 0 mientras no haya con qué estimarlo: se envía sin pausas
+    unsigned long loss_events;
+
+    // NewReno
+    double ssthresh;
+    bool in_recovery;
+
+    // BBR: ancho de banda de entrega por ronda (una ronda = un RTT de datos confirmados)
+    CcBbrPhase phase;
+    double bw_samples[cc_bbr_bw_rounds];
+    unsigned int bw_round;
+    double full_bw;
+    unsigned int full_bw_rounds;
+    long min_rtt_us;
+    long min_rtt_at_us;
+    unsigned long long delivered;
+    unsigned long long round_delivered;
+    long round_start_us;
+    unsigned int cycle;
+}
+CcState;
+
+// un algoritmo de control de congestión
+struct CcOps {
+    const char *name;
+    void (*init)(CcState *cc);
+    // 'acked' frames nuevos confirmados de los 'in_flight' que había en vuelo al llegar
+    // el ack; 'rtt_us' es -1 si el ack no dio muestra de RTT
+    void (*on_ack)(CcState *cc, size_t acked, size_t in_flight, long rtt_us, long srtt_us, long now_us);
+    void (*on_loss)(CcState *cc, CcLoss loss, size_t in_flight);
+    // el ack que sale de la recuperación de una pérdida por acks duplicados
+    void (*on_recovered)(CcState *cc);
+};
+
+// declaraciones de funciones
+const CcOps *cc_find(const char *name);
+void cc_init(CcState *cc, const CcOps *ops, size_t frame_bytes, size_t max_cwnd);
+double cc_bbr_max_bw(const CcState *cc);
+
+// NewReno (RFC 5681/6582): arranque lento, incremento aditivo y reducción a la mitad
+static void cc_reno_init(CcState *cc)
+{
+    cc->ssthresh = 1e9;
+}
+
+static void cc_reno_on_ack(CcState *cc, size_t acked, size_t in_flight, long rtt_us, long srtt_us, long now_us)
+{
+    (void)rtt_us;
+    (void)now_us;
+
+    // La ventana sólo crece si de verdad limitó el envío (RFC 7661): si lo que frenó fue
+    // la ventana de ARQ, la del cliente o la aplicación, el ack no dice nada de la red.
+    // En el arranque lento basta con usar la mitad, como en Linux
+    const bool cwnd_limited = cc->cwnd < cc->ssthresh ? cc->cwnd < 2.0 * (double)in_flight : in_flight >= (size_t)cc->cwnd;
+    if (!cc->in_recovery && cwnd_limited)
+    {
+        if (cc->cwnd < cc->ssthresh)
+        {
+            cc->cwnd += (double)acked;
+        }
+        else
+        {
+            cc->cwnd += (double)acked / cc->cwnd;
+        }
+    }
+
+    // El ritmo reparte la ventana en un RTT, con margen para que no limite al cwnd:
+    // el doble durante el arranque lento y 20% más en el resto (como Linux). La ventana
+    // que cuenta es la que se puede usar, que no pasa de la de ARQ
+    if (srtt_us > 0)
+    {
+        const double gain = cc->cwnd < cc->ssthresh ? 2.0 : 1.2;
+        const double window = cc->cwnd < cc->max_cwnd ? cc->cwnd : cc->max_cwnd;
+        cc->pacing_rate = gain * window * (double)cc->frame_bytes * 1e6 / (double)srtt_us;
+    }
+}
+
+static void cc_reno_on_loss(CcState *cc, CcLoss loss, size_t in_flight)
+{
+    const double half = (double)in_flight / 2 > cc_min_cwnd ? (double)in_flight / 2 : cc_min_cwnd;
+
+    cc->loss_events++;
+    cc->ssthresh = half;
+    if (loss == CC_LOSS_TIMEOUT)
+    {
+        cc->cwnd = 1;
+        cc->in_recovery = false;
+    }
+    else
+    {
+        cc->cwnd = half;
+        cc->in_recovery = true;
+    }
+}
+
+static void cc_reno_on_recovered(CcState *cc)
+{
+    cc->in_recovery = false;
+}
+
+// Estilo BBR: el ritmo sigue al máximo ancho de banda de entrega reciente y la ventana
+// a dos veces el producto ancho de banda por mínimo RTT. La pérdida no reduce el ritmo
+static const double cc_bbr_cycle_gain[] = {1.25, 0.75, 1, 1, 1, 1, 1, 1};
+
+double cc_bbr_max_bw(const CcState *cc)
+{
+    double max_bw = 0;
+    for (unsigned int i = 0; i < cc_bbr_bw_rounds; i++)
+    {
+        max_bw = cc->bw_samples[i] > max_bw ? cc->bw_samples[i] : max_bw;
+    }
+    return max_bw;
+}
+
+static void cc_bbr_init(CcState *cc)
+{
+    cc->phase = CC_BBR_STARTUP;
+    cc->min_rtt_us = -1;
+    cc->round_start_us = -1;
+}
+
+static void cc_bbr_on_ack(CcState *cc, size_t acked, size_t in_flight, long rtt_us, long srtt_us, long now_us)
+{
+    (void)in_flight;
+    (void)srtt_us;
+
+    if (rtt_us >= 0 && (cc->min_rtt_us < 0 || rtt_us <= cc->min_rtt_us || now_us - cc->min_rtt_at_us > cc_bbr_rtt_window_us))
+    {
+        cc->min_rtt_us = rtt_us > 0 ? rtt_us : 1;
+        cc->min_rtt_at_us = now_us;
+    }
+
+    cc->delivered += acked * cc->frame_bytes;
+    if (cc->round_start_us < 0)
+    {
+        cc->round_start_us = now_us;
+        cc->round_delivered = cc->delivered;
+        return;
+    }
+    if (cc->min_rtt_us < 0 || now_us - cc->round_start_us < cc->min_rtt_us)
+    {
+        return;
+    }
+
+    // Terminó una ronda: una muestra de ancho de banda de entrega
+    const double bw = (double)(cc->delivered - cc->round_delivered) * 1e6 / (double)(now_us - cc->round_start_us);
+    cc->bw_samples[cc->bw_round++ % cc_bbr_bw_rounds] = bw;
+    cc->round_start_us = now_us;
+    cc->round_delivered = cc->delivered;
+    const double max_bw = cc_bbr_max_bw(cc);
+
+    // El arranque termina cuando el ancho de banda deja de crecer
+    if (cc->phase == CC_BBR_STARTUP)
+    {
+        if (max_bw >= cc->full_bw * 1.25)
+        {
+            cc->full_bw = max_bw;
+            cc->full_bw_rounds = 0;
+        }
+        else if (++cc->full_bw_rounds >= cc_bbr_startup_rounds)
+        {
+            cc->phase = CC_BBR_DRAIN;
+        }
+    }
+    else if (cc->phase == CC_BBR_DRAIN)
+    {
+        cc->phase = CC_BBR_PROBE_BW;
+    }
+    else
+    {
+        cc->cycle++;
+    }
+
+    double gain = 1;
+    switch (cc->phase)
+    {
+        case CC_BBR_STARTUP:
+            gain = 2.89;
+            break;
+        case CC_BBR_DRAIN:
+            gain = 1 / 2.89;
+            break;
+        case CC_BBR_PROBE_BW:
+            gain = cc_bbr_cycle_gain[cc->cycle % (sizeof cc_bbr_cycle_gain / sizeof cc_bbr_cycle_gain[0])];
+            break;
+    }
+    cc->pacing_rate = gain * max_bw;
+
+    const double bdp = max_bw * (double)cc->min_rtt_us / 1e6 / (double)cc->frame_bytes;
+    const double cwnd = (cc->phase == CC_BBR_STARTUP ? 2.89 : 2) * bdp;
+    cc->cwnd = cwnd > 4 ? cwnd : 4;
+}
+
+static void cc_bbr_on_loss(CcState *cc, CcLoss loss, size_t in_flight)
+{
+    (void)in_flight;
+
+    cc->loss_events++;
+
+    // Tras un RTO no sabemos qué quedó en la red: se reinicia con una ventana chica
+    // hasta la siguiente ronda
+    if (loss == CC_LOSS_TIMEOUT)
+    {
+        cc->cwnd = 4;
+    }
+}
+
+static void cc_bbr_on_recovered(CcState *cc)
+{
+    (void)cc;
+}
+
+static const CcOps cc_algorithms[] = {
+    {"reno", cc_reno_init, cc_reno_on_ack, cc_reno_on_loss, cc_reno_on_recovered},
+    {"bbr", cc_bbr_init, cc_bbr_on_ack, cc_bbr_on_loss, cc_bbr_on_recovered},
+};
+
+// busca un algoritmo por nombre; regresa NULL si no existe
+const CcOps *cc_find(const char *name)
+{
+    for (size_t i = 0; i < sizeof cc_algorithms / sizeof cc_algorithms[0]; i++)
+    {
+        if (strcmp(name, cc_algorithms[i].name) == 0)
+        {
+            return &cc_algorithms[i];
+        }
+    }
+    return NULL;
+}
+
+// deja 'cc' listo para una transferencia nueva con frames de 'frame_bytes' bytes y a lo
+// más 'max_cwnd' frames en vuelo
+void cc_init(CcState *cc, const CcOps *ops, size_t frame_bytes, size_t max_cwnd)
+{
+    memset(cc, 0, sizeof *cc);
+    cc->ops = ops;
+    cc->frame_bytes = frame_bytes;
+    cc->max_cwnd = (double)max_cwnd;
+    cc->cwnd = cc_initial_cwnd;
+    ops->init(cc);
+}
+
+#endif
@@ -1,139 +1,1472 @@
 /** Cliente
 */
 
+#define _GNU_SOURCE
+
 #include <stdint.h>
 #include "helpers.h"
 
-#include <stdbool.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "crc32.h"
+#include "fec.h"
+#include "journal.h"
+#include "log.h"
+#include "lz4.h"
+#include "pool.h"
+#include "uring.h"
+
+#define request_attempts 5 // veces que se repite la solicitud antes de rendirse
+#define datagram_overhead 1024 // memoria que el kernel cuenta por datagrama recibido
+#define ack_frames 4 // frames en orden que se confirman con un solo ack
+#define ack_delay_us 1000L // lo más que se retrasa un ack
+#define streams_max 64 // flujos paralelos de una descarga
+#define pipe_depth_max 1024 // frames en la cola entre el receptor y el escritor
+#define batch_magic "SWBATCH1" // primera línea del índice de un lote
+#define fec_mask_words ((fec_max_k + 63) / 64) // palabras de un bit por cacho de un bloque FEC
+
+// Lo que anuncia el servidor en su respuesta "200"
+typedef struct {
+    ArqMode mode;
+    uint32_t window_size;
+    size_t payload_size;
+    uint64_t length;            // bytes que se van a enviar (el rango pedido)
+    uint64_t total;             // bytes del archivo completo
+    FecCode fec;
+    size_t batch_files;         // archivos de un lote, o 0 si es un solo archivo
+    bool compress;              // los cachos pueden llegar comprimidos con LZ4
+    FileVersion version;        // la fecha de modificación del archivo; 0 si no la anunció
+}
+Handshake;
+
+/**
+ * @brief Recibe un lote de cachos del archivo enviado por el servidor.
+ *        Esta llamada se bloquea hasta que llegue el primero y luego toma los que ya esperan.
+ *
+ * @param sock_fd el file descriptor del socket.
+ * @param frames Los frames en los cuales escribir.
+ * @param lengths Los bytes leídos de cada frame, o -1 si el datagrama no es un frame válido.
+ * @param count La cantidad de frames.
+ * @param server_config La configuración del servidor.
+ * @return El número de datagramas leídos, -1 si error.
+ */
+static int recv_file_chunks(const int sock_fd, Frame *const frames, ssize_t *const lengths, const size_t count, struct sockaddr_in *const server_config)
+{
+    return frame_recv_batch(sock_fd, frames, lengths, count, server_config);
+}
+
+/**
+ * @brief Escribe un cacho de archivo en su lugar dentro del archivo.
+ *
+ * @param fd El file descriptor del archivo hacia cuál escribir.
+ * @param buffer El buffer a copiar.
+ * @param buffer_size El tamaño del buffer en bytes.
+ * @param offset La posición del cacho dentro del archivo.
+ * @return true si se escribió completo.
+ */
+static bool write_file_chunk(const int fd, const char *const buffer, const size_t buffer_size, const off_t offset)
+{
+    size_t written = 0;
+    while (written < buffer_size)
+    {
+        const ssize_t bytes = pwrite(fd, buffer + written, buffer_size - written, offset + (off_t)written);
+        if (bytes <= 0)
+        {
+            return false;
+        }
+        written += (size_t)bytes;
+    }
+    return true;
+}
+
+/**
+ * @brief Escribe un cacho sin esperar al disco: lo encola en el anillo de io_uring, que lo
+ *        envía al kernel con el resto del lote. Sin anillo se escribe con pwrite().
+ *
+ * @param ring El anillo de escrituras, o NULL.
+ * @param fd El file descriptor del archivo hacia cuál escribir.
+ * @param buffer El cacho; se copia, así que se puede reutilizar al regresar.
+ * @param buffer_size El tamaño del cacho en bytes.
+ * @param offset La posición del cacho dentro del archivo.
+ * @return false si esta escritura, o una anterior del anillo, falló.
+ */
+static bool queue_file_chunk(Uring *const ring, const int fd, const char *const buffer, const size_t buffer_size, const off_t offset)
+{
+    return ring != NULL ? uring_write(ring, fd, buffer, buffer_size, offset) == 0 : write_file_chunk(fd, buffer, buffer_size, offset);
+}
+
+// Lo que el receptor deja dicho de cada frame de la cola
+typedef struct {
+    uint64_t position;          // del cacho dentro del archivo
+    size_t chunk_size;          // (o de la paridad)
+    uint32_t crc;               // CRC-32 de la carga útil; si viene comprimida, lo calcula el escritor
+    bool write;                 // false si el frame se descartó o no trae datos
+    bool parity;                // es paridad FEC y el escritor la copia a 'parity_offset'
+    size_t parity_offset;
+
+    // Con este frame alcanzó la paridad del bloque 'rebuild_block' (más uno; 0 si no):
+    // el escritor reconstruye los cachos de 'rebuild' con los de 'present' y la paridad
+    // de 'parity_mask', que ya pasaron antes por la cola
+    uint64_t rebuild_block;
+    uint32_t parity_mask;
+    uint64_t present[fec_mask_words];
+    uint64_t rebuild[fec_mask_words];
+}
+PipeSlot;
+
+#define pipe_writer 1
+#define pipe_receiver 2
+
+// Paridad FEC recibida de los bloques que siguen incompletos. Un bloque cabe en un
+// lugar mientras alguno de sus frames esté en la ventana, así que bastan
+// window_size / k + 2 lugares, indexados por bloque % slot_count. El receptor lleva
+// 'blocks' y 'masks' para saber cuándo alcanza la paridad; el escritor guarda la
+// paridad misma y reconstruye, en el orden de la cola
+typedef struct {
+    FecCode code;
+    uint32_t slot_count;
+    uint64_t *blocks;           // bloque + 1 en cada lugar; 0 si está libre
+    uint32_t *masks;            // índices de la paridad recibida de cada bloque
+    unsigned char *parity;      // m frames de paridad por lugar; sólo del escritor
+    unsigned char *scratch;     // los k cachos de un bloque mientras se reconstruye; sólo del escritor
+    size_t frame_size;
+    uint64_t base;              // posición del rango de la transferencia dentro del archivo
+    int received;
+    int recovered;
+}
+FecState;
+
+/**
+ * @brief Reserva el estado de FEC para la ventana y la carga útil negociadas.
+ *
+ * @return true en éxito, o si no se usa FEC.
+ */
+static bool fec_state_init(FecState *const fec, const FecCode *const code, const uint32_t window_size, const size_t payload_size,
+                           const uint64_t base)
+{
+    memset(fec, 0, sizeof *fec);
+    fec->code = *code;
+    fec->base = base;
+    if (code->scheme == FEC_NONE)
+    {
+        return true;
+    }
+    fec->slot_count = window_size / code->k + 2;
+    fec->frame_size = payload_size;
+    fec->blocks = calloc(fec->slot_count, sizeof *fec->blocks);
+    fec->masks = calloc(fec->slot_count, sizeof *fec->masks);
+    fec->parity = malloc((size_t)fec->slot_count * code->m * payload_size);
+    fec->scratch = malloc((size_t)code->k * payload_size);
+    return fec->blocks != NULL && fec->masks != NULL && fec->parity != NULL && fec->scratch != NULL;
+}
+
+static void fec_state_free(FecState *const fec)
+{
+    free(fec->blocks);
+    free(fec->masks);
+    free(fec->parity);
+    free(fec->scratch);
+}
+
+/**
+ * @brief Guarda un frame de paridad si su bloque sigue incompleto: anota que llegó y
+ *        deja dicho en su lugar de la cola dónde la copia el escritor.
+ *
+ * @param fec El estado de FEC.
+ * @param frame El frame de paridad, ya verificado.
+ * @param pipe_slot Su lugar en la cola.
+ * @param expected El siguiente seqnum que falta.
+ * @param chunk_count Los cachos de datos del archivo.
+ * @param frame_size El tamaño que debe tener la paridad de este bloque.
+ * @return true si se guardó.
+ */
+static bool fec_store_parity(FecState *const fec, const Frame *const frame, PipeSlot *const pipe_slot, const uint32_t expected, const uint64_t chunk_count,
+                             const size_t frame_size)
+{
+    const uint64_t block = frame->seqnum / fec->code.k;
+    const uint32_t index = (uint32_t)frame->ack;
+    if (frame->seqnum % fec->code.k != 0 || frame->seqnum >= chunk_count || index >= fec->code.m || frame->items != frame_size ||
+        (uint64_t)frame->seqnum + fec->code.k <= expected)
+    {
+        return false;
+    }
+
+    const uint32_t slot = (uint32_t)(block % fec->slot_count);
+    if (fec->blocks[slot] != block + 1)
+    {
+        fec->blocks[slot] = block + 1;
+        fec->masks[slot] = 0;
+    }
+    pipe_slot->parity = true;
+    pipe_slot->parity_offset = ((size_t)slot * fec->code.m + index) * fec->frame_size;
+    pipe_slot->chunk_size = frame_size;
+    fec->masks[slot] |= 1u << index;
+    fec->received++;
+    return true;
+}
+
+
+// Cola SPSC entre el hilo que recibe y confirma y el que expande y escribe, así que
+// el disco no retrasa los acks. Los frames se reciben directo en sus lugares de la cola;
+// el receptor publica 'tail' y el escritor 'head', cada uno sin candado. El candado y la
+// condición sólo sirven para dormir: al escritor con la cola vacía y al receptor con la
+// cola llena, lo que también frena al servidor, porque sin espacio no salen acks
+typedef struct {
+    Frame *frames;
+    PipeSlot *slots;
+    Pool buffers;               // la carga útil de cada frame, alineada a línea de caché
+    uint32_t depth;             // potencia de dos
+    uint32_t head;
+    uint32_t tail;
+    uint32_t flush_requested;   // el receptor pide que lo publicado llegue al archivo...
+    uint32_t flushed;           // ... y el escritor responde con el mismo número
+    bool stop;
+    bool failed;                // no se pudo escribir
+    bool corrupt;               // un cacho comprimido no se pudo expandir
+    int sleeping;               // pipe_writer | pipe_receiver
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+
+    // Sólo del escritor hasta que termina un flush
+    int fd;
+    size_t payload_size;
+    uint64_t length;            // bytes del rango
+    Journal *journal;
+    uint32_t *chunk_crcs;       // CRC-32 de cada cacho del rango, por seqnum
+    FecState *fec;
+    char *inflated;
+    const char *engine;         // con qué se escribe
+}
+Pipeline;
+
+static bool pipeline_writer_ready(const Pipeline *const pipe)
+{
+    return __atomic_load_n(&pipe->tail, __ATOMIC_SEQ_CST) != pipe->head || __atomic_load_n(&pipe->flush_requested, __ATOMIC_SEQ_CST) != pipe->flushed ||
+           __atomic_load_n(&pipe->stop, __ATOMIC_SEQ_CST);
+}
+
+static bool pipeline_has_space(const Pipeline *const pipe)
+{
+    return pipe->tail - __atomic_load_n(&pipe->head, __ATOMIC_SEQ_CST) < pipe->depth;
+}
+
+// La ventana que anuncian los acks: los lugares libres de la cola, que no pasan de la
+// ventana de ARQ. Un frame que espera al escritor sigue ocupando el suyo
+static uint16_t pipeline_window(const Pipeline *const pipe, const uint32_t window_size)
+{
+    const uint32_t space = pipe->depth - (pipe->tail - __atomic_load_n(&pipe->head, __ATOMIC_SEQ_CST));
+    const uint32_t window = space < window_size ? space : window_size;
+    return (uint16_t)(window < UINT16_MAX ? window : UINT16_MAX);
+}
+
+static bool pipeline_is_flushed(const Pipeline *const pipe)
+{
+    return __atomic_load_n(&pipe->flushed, __ATOMIC_SEQ_CST) == pipe->flush_requested;
+}
+
+// Duerme al hilo 'who' hasta que se cumpla 'ready'; el otro hilo lo despierta con pipeline_wake()
+static void pipeline_sleep(Pipeline *const pipe, const int who, bool (*const ready)(const Pipeline *))
+{
+    pthread_mutex_lock(&pipe->lock);
+    __atomic_fetch_or(&pipe->sleeping, who, __ATOMIC_SEQ_CST);
+    while (!ready(pipe))
+    {
+        pthread_cond_wait(&pipe->wake, &pipe->lock);
+    }
+    __atomic_fetch_and(&pipe->sleeping, ~who, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&pipe->lock);
+}
+
+// Despierta al hilo 'who' si está dormido. Va después de publicar, así que o él ve el cambio
+// antes de dormir, o aquí se ve que duerme
+static void pipeline_wake(Pipeline *const pipe, const int who)
+{
+    if (__atomic_load_n(&pipe->sleeping, __ATOMIC_SEQ_CST) & who)
+    {
+        pthread_mutex_lock(&pipe->lock);
+        pthread_cond_broadcast(&pipe->wake);
+        pthread_mutex_unlock(&pipe->lock);
+    }
+}
+
+// Publica los frames del receptor hasta 'tail' (sin incluirlo)
+static void pipeline_publish(Pipeline *const pipe, const uint32_t tail)
+{
+    __atomic_store_n(&pipe->tail, tail, __ATOMIC_SEQ_CST);
+    pipeline_wake(pipe, pipe_writer);
+}
+
+/**
+ * @brief Espera a que todo lo publicado esté escrito en el archivo, p. ej. antes de
+ *        calcular el CRC del rango.
+ *
+ * @return false si alguna escritura falló.
+ */
+static bool pipeline_flush(Pipeline *const pipe)
+{
+    __atomic_store_n(&pipe->flush_requested, pipe->flush_requested + 1, __ATOMIC_SEQ_CST);
+    pipeline_wake(pipe, pipe_writer);
+    pipeline_sleep(pipe, pipe_receiver, pipeline_is_flushed);
+    return !__atomic_load_n(&pipe->failed, __ATOMIC_SEQ_CST);
+}
+
+// Expande (si hace falta), escribe y marca en la bitácora un cacho de la cola
+static void pipeline_write(Pipeline *const pipe, const Frame *const frame, const PipeSlot *const slot, Uring *const ring)
+{
+    const char *chunk = frame->packet.data;
+    uint32_t crc = slot->crc;
+
+    // La carga útil ya pasó el CRC del frame; el del archivo cubre el cacho expandido
+    if (frame->flags & FRAME_COMPRESSED)
+    {
+        if (lz4_decompress((const unsigned char *)frame->packet.data, (unsigned int)frame->items, (unsigned char *)pipe->inflated,
+                           (unsigned int)slot->chunk_size) != (int)slot->chunk_size)
+        {
+            __atomic_store_n(&pipe->corrupt, true, __ATOMIC_SEQ_CST);
+            return;
+        }
+        chunk = pipe->inflated;
+        crc = crc32_update((unsigned int)slot->chunk_size, 0, (const unsigned char *)chunk);
+    }
+    if (!queue_file_chunk(ring, pipe->fd, chunk, slot->chunk_size, (off_t)slot->position))
+    {
+        __atomic_store_n(&pipe->failed, true, __ATOMIC_SEQ_CST);
+        return;
+    }
+    pipe->chunk_crcs[frame->seqnum] = crc;
+    journal_mark(pipe->journal, slot->position / pipe->payload_size, crc);
+}
+
+/**
+ * @brief Reconstruye con FEC los cachos que le faltaban a un bloque. Corre en el escritor,
+ *        después de los frames anteriores de la cola, así que los cachos presentes ya se
+ *        escribieron: se espera a sus escrituras y se releen del archivo (están en el page
+ *        cache). Los reconstruidos se escriben en su lugar como si hubieran llegado.
+ *
+ * @return false si no se pudo; los cachos ya se confirmaron, así que la descarga falla.
+ */
+static bool pipeline_rebuild(Pipeline *const pipe, const PipeSlot *const slot, Uring *const ring)
+{
+    FecState *const fec = pipe->fec;
+    const uint64_t block = slot->rebuild_block - 1;
+    const uint32_t fec_slot = (uint32_t)(block % fec->slot_count);
+    const size_t payload_size = fec->frame_size;
+    const uint64_t chunk_count = (pipe->length + payload_size - 1) / payload_size;
+    const uint64_t first = block * fec->code.k;
+    const unsigned int count = chunk_count - first < fec->code.k ? (unsigned int)(chunk_count - first) : fec->code.k;
+    const size_t frame_size = pipe->length - first * payload_size < payload_size ? pipe->length - first * payload_size : payload_size;
+    unsigned char *data[fec_max_k] = {NULL};
+    unsigned char present[fec_max_k];
+    unsigned char *parity[fec_max_m];
+    unsigned int parity_index[fec_max_m];
+    unsigned int parity_count = 0;
+
+    for (unsigned int j = 0; j < fec->code.m; j++)
+    {
+        if (slot->parity_mask & (1u << j))
+        {
+            parity[parity_count] = fec->parity + ((size_t)fec_slot * fec->code.m + j) * payload_size;
+            parity_index[parity_count++] = j;
+        }
+    }
+    if (ring != NULL && uring_flush(ring) < 0)
+    {
+        return false;
+    }
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const uint64_t position = (first + i) * payload_size;
+        const size_t chunk_size = pipe->length - position < payload_size ? pipe->length - position : payload_size;
+        present[i] = (slot->present[i / 64] & (1ULL << (i % 64))) != 0;
+        data[i] = fec->scratch + (size_t)i * payload_size;
+        memset(data[i] + chunk_size, 0, frame_size - chunk_size);
+        if (present[i] && pread(pipe->fd, data[i], chunk_size, (off_t)(fec->base + position)) != (ssize_t)chunk_size)
+        {
+            return false;
+        }
+    }
+    if (fec_decode(&fec->code, data, present, count, parity, parity_index, parity_count, frame_size) <= 0)
+    {
+        return false;
+    }
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const uint32_t seqnum = (uint32_t)(first + i);
+        const uint64_t position = (uint64_t)seqnum * payload_size;
+        const size_t chunk_size = pipe->length - position < payload_size ? pipe->length - position : payload_size;
+        if (!(slot->rebuild[i / 64] & (1ULL << (i % 64))))
+        {
+            continue;
+        }
+        if (!write_file_chunk(pipe->fd, (const char *)data[i], chunk_size, (off_t)(fec->base + position)))
+        {
+            return false;
+        }
+        pipe->chunk_crcs[seqnum] = crc32_update((unsigned int)chunk_size, 0, data[i]);
+        journal_mark(pipe->journal, (fec->base + position) / payload_size, pipe->chunk_crcs[seqnum]);
+        log_debug("[+] Mensaje reconstruido con FEC. Seqnum: %u, bytes: %zu\n", seqnum, chunk_size);
+    }
+    return true;
+}
+
+// Expande (si hace falta), escribe y marca en la bitácora un frame de la cola; si es
+// paridad la guarda, y si completó un bloque FEC lo reconstruye
+static void pipeline_store(Pipeline *const pipe, const uint32_t index, Uring *const ring)
+{
+    const Frame *const frame = &pipe->frames[index];
+    const PipeSlot *const slot = &pipe->slots[index];
+    if (slot->parity)
+    {
+        memcpy(pipe->fec->parity + slot->parity_offset, frame->packet.data, slot->chunk_size);
+    }
+    if (slot->write)
+    {
+        pipeline_write(pipe, frame, slot, ring);
+    }
+    if (slot->rebuild_block != 0 && !pipeline_rebuild(pipe, slot, ring))
+    {
+        __atomic_store_n(&pipe->failed, true, __ATOMIC_SEQ_CST);
+    }
+}
+
+// Hilo escritor: vacía la cola en orden. Las escrituras van por io_uring si el kernel lo
+// tiene (si no, con pwrite()) y salen juntas cada vez que la cola se vacía
+static void *pipeline_main(void *const arg)
+{
+    Pipeline *const pipe = arg;
+    Uring uring;
+    Uring *const ring = uring_init(&uring, pipe->depth, pipe->payload_size) == 0 ? &uring : NULL;
+    pipe->engine = ring == NULL ? "pwrite" : ring->fixed ? "io_uring (buffers registrados)" : "io_uring";
+
+    for (;;)
+    {
+        if (__atomic_load_n(&pipe->tail, __ATOMIC_SEQ_CST) != pipe->head)
+        {
+            pipeline_store(pipe, pipe->head & (pipe->depth - 1), ring);
+            __atomic_store_n(&pipe->head, pipe->head + 1, __ATOMIC_SEQ_CST);
+            pipeline_wake(pipe, pipe_receiver);
+            continue;
+        }
+        if (ring != NULL && uring_submit(ring) < 0)
+        {
+            __atomic_store_n(&pipe->failed, true, __ATOMIC_SEQ_CST);
+        }
+
+        // La petición se publica después de los frames: si ahora hay más, primero esos
+        const uint32_t requested = __atomic_load_n(&pipe->flush_requested, __ATOMIC_SEQ_CST);
+        if (requested != pipe->flushed)
+        {
+            if (__atomic_load_n(&pipe->tail, __ATOMIC_SEQ_CST) != pipe->head)
+            {
+                continue;
+            }
+            if (ring != NULL && uring_flush(ring) < 0)
+            {
+                __atomic_store_n(&pipe->failed, true, __ATOMIC_SEQ_CST);
+            }
+            __atomic_store_n(&pipe->flushed, requested, __ATOMIC_SEQ_CST);
+            pipeline_wake(pipe, pipe_receiver);
+            continue;
+        }
+        if (__atomic_load_n(&pipe->stop, __ATOMIC_SEQ_CST))
+        {
+            break;
+        }
+        pipeline_sleep(pipe, pipe_writer, pipeline_writer_ready);
+    }
+
+    if (ring != NULL)
+    {
+        uring_flush(ring);
+        uring_exit(ring);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Reserva la cola para al menos 'min_depth' frames de 'slot_size' bytes y arranca
+ *        el hilo escritor.
+ *
+ * @return true en éxito.
+ */
+static bool pipeline_start(Pipeline *const pipe, const uint32_t min_depth, const size_t slot_size, const int fd, const size_t payload_size,
+                           const uint64_t length, Journal *const journal, uint32_t *const chunk_crcs, FecState *const fec, const bool compress)
+{
+    memset(pipe, 0, sizeof *pipe);
+    pipe->depth = 1;
+    while (pipe->depth < min_depth)
+    {
+        pipe->depth *= 2;
+    }
+    pipe->fd = fd;
+    pipe->payload_size = payload_size;
+    pipe->length = length;
+    pipe->journal = journal;
+    pipe->chunk_crcs = chunk_crcs;
+    pipe->fec = fec;
+    pipe->frames = calloc(pipe->depth, sizeof *pipe->frames);
+    pipe->slots = calloc(pipe->depth, sizeof *pipe->slots);
+    pipe->inflated = compress ? malloc(payload_size) : NULL;
+    bool allocated = pipe->frames != NULL && pipe->slots != NULL && (!compress || pipe->inflated != NULL);
+    pool_init(&pipe->buffers, slot_size, pipe->depth, false);
+    for (uint32_t i = 0; allocated && i < pipe->depth; i++)
+    {
+        pipe->frames[i].packet.data = pool_get(&pipe->buffers);
+        pipe->frames[i].packet.size = slot_size;
+        allocated = pipe->frames[i].packet.data != NULL;
+    }
+    pthread_mutex_init(&pipe->lock, NULL);
+    pthread_cond_init(&pipe->wake, NULL);
+    return allocated && pthread_create(&pipe->thread, NULL, pipeline_main, pipe) == 0;
+}
+
+// detiene el escritor, que antes termina lo publicado, y libera la cola
+static void pipeline_stop(Pipeline *const pipe)
+{
+    __atomic_store_n(&pipe->stop, true, __ATOMIC_SEQ_CST);
+    pipeline_wake(pipe, pipe_writer);
+    pthread_join(pipe->thread, NULL);
+    pool_exit(&pipe->buffers);
+    free(pipe->frames);
+    free(pipe->slots);
+    free(pipe->inflated);
+    pthread_mutex_destroy(&pipe->lock);
+    pthread_cond_destroy(&pipe->wake);
+}
+
+/**
+ * @brief Si ya llegó suficiente paridad para los cachos que le faltan a un bloque, los da
+ *        por recibidos y deja al escritor la orden de reconstruirlos en el lugar de la cola
+ *        del frame que la completó: el escritor llega a él después de escribir los cachos
+ *        presentes y de guardar la paridad, así que el receptor nunca espera al disco.
+ *
+ * @param fec El estado de FEC.
+ * @param block El bloque.
+ * @param pipe_slot El lugar en la cola del frame que acaba de llegar.
+ * @param written Los bits de los cachos escritos.
+ * @param window_size El tamaño de la ventana.
+ * @param expected El siguiente seqnum que falta.
+ * @param received_end Uno más que el mayor seqnum escrito; se actualiza.
+ * @param chunk_count Los cachos de datos del archivo.
+ * @return Cuántos cachos se van a reconstruir.
+ */
+static int fec_recover(FecState *const fec, const uint64_t block, PipeSlot *const pipe_slot, uint64_t *const written, const uint32_t window_size,
+                       const uint32_t expected, uint32_t *const received_end, const uint64_t chunk_count)
+{
+    const uint32_t slot = (uint32_t)(block % fec->slot_count);
+    if (fec->blocks[slot] != block + 1)
+    {
+        return 0;
+    }
+
+    const uint64_t first = block * fec->code.k;
+    const unsigned int count = chunk_count - first < fec->code.k ? (unsigned int)(chunk_count - first) : fec->code.k;
+    const unsigned int parity_count = (unsigned int)__builtin_popcount(fec->masks[slot]);
+    unsigned int missing = 0;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const uint64_t seqnum = first + i;
+        missing += (written[seqnum / 64] & (1ULL << (seqnum % 64))) == 0;
+    }
+    if (missing == 0 || missing > parity_count)
+    {
+        fec->blocks[slot] = missing == 0 ? 0 : fec->blocks[slot];
+        return 0;
+    }
+
+    // Los cachos fuera de la ventana se reconstruyen para decodificar, pero no se escriben
+    pipe_slot->rebuild_block = block + 1;
+    pipe_slot->parity_mask = fec->masks[slot];
+    memset(pipe_slot->present, 0, sizeof pipe_slot->present);
+    memset(pipe_slot->rebuild, 0, sizeof pipe_slot->rebuild);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const uint32_t seqnum = (uint32_t)(first + i);
+        if (written[seqnum / 64] & (1ULL << (seqnum % 64)))
+        {
+            pipe_slot->present[i / 64] |= 1ULL << (i % 64);
+        }
+        else if (seqnum - expected < window_size)
+        {
+            pipe_slot->rebuild[i / 64] |= 1ULL << (i % 64);
+            written[seqnum / 64] |= 1ULL << (seqnum % 64);
+            *received_end = (int32_t)(seqnum + 1 - *received_end) > 0 ? seqnum + 1 : *received_end;
+            fec->recovered++;
+        }
+    }
+    fec->blocks[slot] = 0;
+    return (int)missing;
+}
+
+/**
+ * @brief Espera a que llegue algo al socket, a lo más 'timeout_us' microsegundos.
+ *
+ * @param sock_fd El file descriptor del socket.
+ * @param timeout_us El plazo en microsegundos.
+ * @return true si hay algo que leer antes del plazo.
+ */
+static bool wait_readable(const int sock_fd, const long timeout_us)
+{
+    if (timeout_us <= 0)
+    {
+        return false;
+    }
+    struct pollfd poll_fd = {.fd = sock_fd, .events = POLLIN};
+    const struct timespec timeout = {timeout_us / 1000000, (timeout_us % 1000000) * 1000};
+    return ppoll(&poll_fd, 1, &timeout, NULL) > 0;
+}
+
+/**
+ * @brief Llena el mapa SACK con los cachos ya escritos después de 'expected' que caben
+ *        en la ventana.
+ *
+ * @param bitmap El mapa a llenar, de sack_bytes_max bytes.
+ * @param written Los bits de los cachos escritos.
+ * @param expected El siguiente seqnum que falta.
+ * @param window_size El tamaño de la ventana.
+ * @param last_seqnum El seqnum del último frame.
+ * @return Los bytes del mapa hasta el último bit encendido, 0 si no hay ninguno.
+ */
+static size_t sack_fill(uint8_t *const bitmap, const uint64_t *const written, const uint32_t expected, const uint32_t window_size, const uint64_t last_seqnum)
+{
+    size_t bytes = 0;
+    memset(bitmap, 0, sack_bytes_max);
+    for (uint32_t i = 0; i + 1 < window_size && i < sack_bytes_max * 8 && (uint64_t)expected + 1 + i <= last_seqnum; i++)
+    {
+        const uint64_t seqnum = (uint64_t)expected + 1 + i;
+        if (written[seqnum / 64] & (1ULL << (seqnum % 64)))
+        {
+            bitmap[i / 8] |= (uint8_t)(1u << (i % 8));
+            bytes = i / 8 + 1;
+        }
+    }
+    return bytes;
+}
+
+/**
+ * @brief Prepara un ack: confirma el frame 'seqnum' y, acumulativamente, todos los
+ *        anteriores a 'ack'. La carga útil es el mapa SACK o, en el último, el CRC.
+ */
+static void ack_prepare(Frame *const frame, const uint32_t seqnum, const int32_t ack, void *const payload, const size_t items, const uint16_t flags)
+{
+    frame->seqnum = seqnum;
+    frame->ack = ack;
+    frame->packet.data = payload;
+    frame->packet.size = items;
+    frame->items = items;
+    frame->flags = flags;
+}
+
+/**
+ * Envía los acknowledgements de un lote al servidor con una sola llamada.
+ *
+ * @param sock_fd El file descriptor del socket.
+ * @param frames Los frames a ser enviados.
+ * @param count La cantidad de frames.
+ * @param server_config La configuración del servidor.
+ */
+static void send_acks(const int sock_fd, Frame *const *const frames, const size_t count, const struct sockaddr_in *const server_config)
+{
+    frame_send_batch(sock_fd, frames, count, server_config, 0);
+}
+
+/**
+ * @brief Envía la solicitud de un archivo y espera la respuesta del servidor.
+ *        La solicitud se repite si no llega respuesta en 'time_default' milisegundos,
+ *        ya que un servidor ocupado puede perderla. Los frames de datos que lleguen
+ *        antes de la respuesta (de una solicitud repetida) se ignoran.
+ *
+ * @param sock_fd El file descriptor del socket.
+ * @param request La solicitud: el path y sus parámetros.
+ * @param reply El buffer para la respuesta. Siempre será terminado en nul en éxito.
+ * @param reply_size La capacidad del buffer en bytes.
+ * @param server_config La configuración del servidor.
+ * @return La longitud de la respuesta, o -1 si el servidor nunca contestó.
+ */
+static ssize_t request_file(const int sock_fd, const char *const request, char *const reply, const size_t reply_size, struct sockaddr_in *const server_config)
+{
+    const struct timeval timeout = {time_default / 1000, (time_default % 1000) * 1000};
+    const struct timeval no_timeout = {0, 0};
+    ssize_t reply_len = -1;
+    Frame frame;
+
+    setsockopt(sock_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+    for (int attempt = 0; attempt < request_attempts && reply_len < 0; attempt++)
+    {
+        sendto(sock_fd, request, strlen(request), 0, (struct sockaddr *)server_config, sizeof *server_config);
+
+        socklen_t server_size = sizeof *server_config;
+        ssize_t bytes;
+        while ((bytes = recvfrom(sock_fd, reply, reply_size - 1, MSG_TRUNC, (struct sockaddr *)server_config, &server_size)) >= 0)
+        {
+            // Un datagrama más grande que el buffer o un frame válido no es la respuesta
+            if ((size_t)bytes >= reply_size || frame_decode(&frame, reply, (size_t)bytes))
+            {
+                continue;
+            }
+            reply[bytes] = '\0';
+            reply_len = bytes;
+            break;
+        }
+    }
+    setsockopt(sock_fd, SOL_SOCKET, SO_RCVTIMEO, &no_timeout, sizeof no_timeout);
+    return reply_len;
+}
+
+/**
+ * @brief Interpreta la respuesta "200" del servidor, p. ej.
+ *        "200 mode=sr window=8 size=4096 length=1048576 total=1048576 fec=rs:8:2".
+ *
+ * @param reply La respuesta.
+ * @param payload_size La carga útil que pedimos; el servidor nunca acepta una mayor.
+ * @param handshake Lo anunciado por el servidor.
+ * @return false si la respuesta no trae lo necesario.
+ */
+static bool parse_reply(const char *const reply, const size_t payload_size, Handshake *const handshake)
+{
+    const char *const mode_value = handshake_value(reply, "mode");
+    const char *const window_value = handshake_value(reply, "window");
+    const char *const size_value = handshake_value(reply, "size");
+    const char *const length_value = handshake_value(reply, "length");
+    const char *const total_value = handshake_value(reply, "total");
+    const char *const fec_value = handshake_value(reply, "fec");
+    const char *const batch_value = handshake_value(reply, "batch");
+    const char *const compress_value = handshake_value(reply, "compress");
+    const char *const mtime_value = handshake_value(reply, "mtime");
+    const long window_size = window_value != NULL ? strtol(window_value, NULL, 10) : 1;
+    const long size = size_value != NULL ? strtol(size_value, NULL, 10) : 0;
+
+    if (strncmp(reply, "200", 3) != 0)
+    {
+        return false;
+    }
+
+    handshake->mode = mode_value != NULL ? parse_mode(mode_value) : MODE_SW;
+    handshake->window_size = (uint32_t)window_size;
+    if ((int)handshake->mode == -1 || window_size < 1)
+    {
+        handshake->mode = MODE_SW;
+        handshake->window_size = 1;
+    }
+    handshake->payload_size = size >= 1 ? (size_t)size : payload_size;
+
+    if (length_value == NULL)
+    {
+        printf("[-] El servidor no anunció el tamaño del archivo.\n");
+        return false;
+    }
+    handshake->length = strtoull(length_value, NULL, 10);
+    handshake->total = total_value != NULL ? strtoull(total_value, NULL, 10) : handshake->length;
+    handshake->batch_files = batch_value != NULL ? (size_t)strtoull(batch_value, NULL, 10) : 0;
+    handshake->compress = compress_value != NULL && strncmp(compress_value, "lz4", 3) == 0;
+    handshake->version = (FileVersion){0, 0};
+    if (mtime_value != NULL)
+    {
+        char *end;
+        handshake->version.sec = strtoll(mtime_value, &end, 10);
+        handshake->version.nsec = *end == '.' ? strtoll(end + 1, NULL, 10) : 0;
+    }
+
+    // Con FEC el servidor agrega paridad, p. ej. "fec=rs:8:2"
+    handshake->fec = (FecCode){FEC_NONE, 0, 0};
+    if (fec_value != NULL && (handshake->mode != MODE_SR || fec_parse(&handshake->fec, fec_value) < 0))
+    {
+        printf("[-] El servidor anunció un código FEC no valido.\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Crea el archivo destino, sobreescribiendo si existe. También se abre para
+ *        leer: FEC reconstruye los cachos que faltan a partir de los ya escritos.
+ *
+ * @return El file descriptor; termina el programa si no se pudo.
+ */
+static int open_output(const char *const filename)
+{
+    const int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        printf("[-] No se pudo abrir \"%s\" para escribir.\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+/**
+ * @brief Reserva el archivo destino completo de antemano para que no se fragmente;
+ *        si el sistema de archivos no sabe, basta con fijar su tamaño.
+ */
+static void reserve_output(const int fd, const char *const filename, const uint64_t length)
+{
+    if (length > 0 && fallocate(fd, 0, 0, (off_t)length) < 0 && ftruncate(fd, (off_t)length) < 0)
+    {
+        printf("[-] No se pudo reservar %llu bytes para \"%s\".\n", (unsigned long long)length, filename);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Descarga el archivo (o el rango de él) que anunció el servidor.
+ *        Cada cacho se escribe en su lugar (base + seqnum * payload_size) del archivo ya
+ *        reservado en cuanto llega, sin importar el orden. Fuera de Selective Repeat
+ *        sólo se acepta el siguiente en orden.
+ *
+ * @param sock_fd El file descriptor del socket. Se cierra al terminar.
+ * @param fd El archivo destino, ya reservado.
+ * @param filename El path del archivo destino.
+ * @param base La posición del rango dentro del archivo.
+ * @param server_config La configuración del servidor.
+ * @param handshake El modo, la ventana, la carga útil, el tamaño del rango y el código FEC
+ *        anunciados por el servidor.
+ * @param journal La bitácora donde se marca cada cacho escrito, o NULL.
+ * @return true si el CRC-32 de lo escrito coincide con el que envió el servidor.
+ */
+static bool get_file(const int sock_fd, const int fd, const char *const filename, const uint64_t base, struct sockaddr_in *const server_config,
+                     double p_percent, const Handshake *const handshake, Journal *const journal)
+{
+    const ArqMode mode = handshake->mode;
+    const uint32_t window_size = handshake->window_size;
+    const size_t payload_size = handshake->payload_size;
+    const uint64_t file_length = handshake->length;
+    printf("[+] Obteniendo archivo \"%s\" desde %llu (modo %s, ventana %u)\n", filename, (unsigned long long)base, mode_name(mode), window_size);
+
+    // Un bit por cacho (más uno por el último frame, que trae el CRC) indica si ya está escrito.
+    // El escritor guarda el CRC de cada cacho y al final se combinan en el del rango
+    const uint64_t chunk_count = (file_length + payload_size - 1) / payload_size;
+    uint64_t *const written = calloc(chunk_count / 64 + 1, sizeof *written);
+    uint32_t *const chunk_crcs = calloc(chunk_count + 1, sizeof *chunk_crcs);
+    FecState fec;
+    if (!fec_state_init(&fec, &handshake->fec, window_size, payload_size, base) || written == NULL || chunk_crcs == NULL)
+    {
+        printf("[-] No se pudo reservar una ventana de %u frames.\n", window_size);
+        exit(EXIT_FAILURE);
+    }
+
+    // Los frames se reciben en la cola del escritor, que cabe una ventana más un lote.
+    // Cada lugar tiene el tamaño de la carga útil negociada (y cabe al menos el CRC
+    // del último frame). Los acks llevan los lugares libres de la cola como ventana
+    // de recepción, en Selective Repeat después del mapa SACK
+    const size_t batch_size = window_size < frame_batch_max ? window_size : frame_batch_max;
+    ssize_t recv_lengths[frame_batch_max];
+    Frame send_frames[frame_batch_max] = {0};
+    Frame *send_batch[frame_batch_max];
+    uint32_t file_crc_net = 0;
+    uint16_t rwnd_net = 0;
+    uint8_t sack[sack_bytes_max + rwnd_bytes];
+    for (size_t i = 0; i < batch_size; i++)
+    {
+        send_batch[i] = &send_frames[i];
+    }
+
+    const size_t slot_size = payload_size > sizeof(uint32_t) ? payload_size : sizeof(uint32_t);
+    Pipeline pipe;
+    const uint32_t pipe_depth = window_size + (uint32_t)batch_size < pipe_depth_max ? window_size + (uint32_t)batch_size : pipe_depth_max;
+    if (!pipeline_start(&pipe, pipe_depth, slot_size, fd, payload_size, file_length, journal, chunk_crcs, &fec, handshake->compress))
+    {
+        printf("[-] No se pudo reservar una ventana de %u frames.\n", window_size);
+        exit(EXIT_FAILURE);
+    }
+
+    // Le damos al kernel espacio para una ventana completa, que ahora llega en ráfagas.
+    // El kernel cobra cada datagrama con su sk_buff, no sólo con sus bytes
+    const int rcvbuf = (int)(window_size * (payload_size + sizeof(FrameHeader) + datagram_overhead));
+    setsockopt(sock_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+
+    int msg_counter = 0;
+    int ack_counter = 0;
+    int lost_packets = 0;
+    int compressed_frames = 0;
+    uint64_t wire_bytes = 0;
+
+    // Los frames que llegan en orden se confirman juntos: un ack cada 'ack_every' frames
+    // (o por lote) y, si no llegan más, a los 'ack_delay_us'. Con un hueco en la ventana el
+    // ack sale de inmediato; en Go-Back-N uno por frame fuera de orden, que el servidor
+    // cuenta como duplicados, y en Selective Repeat uno por lote con el mapa SACK
+    uint32_t ack_every = window_size / 2 < ack_frames ? window_size / 2 : ack_frames;
+    ack_every = ack_every > 0 ? ack_every : 1;
+    uint32_t unacked = 0;
+    long unacked_since_us = 0;
+    uint32_t ack_seqnum = 0;
+    uint32_t received_end = 0; // uno más que el mayor seqnum escrito
+
+    // Siguiente seqnum que falta en el archivo (todos los anteriores ya están escritos)
+    uint32_t expected = 0;
+
+    // CRC-32 de lo escrito hasta ahora y el que anuncia el servidor al final
+    uint32_t file_crc = 0;
+    uint32_t server_crc = 0;
+    uint32_t payload_crc = 0;
+
+    // Cambiamos a 'true' en la últime iteración
+    bool done = false;
+    do
+    {
+        // Tomamos de una vez todos los cachos que ya esperan en el socket. Con un ack
+        // pendiente se espera sólo hasta su plazo, y si vence sale sin recibir nada
+        size_t ack_count = 0;
+        bool ack_now = false;
+        int batch_count = 0;
+        if (unacked > 0 && !wait_readable(sock_fd, ack_delay_us - (monotonic_us() - unacked_since_us)))
+        {
+            ack_now = true;
+        }
+        else
+        {
+            // Se recibe en los lugares libres de la cola, sin dar la vuelta; si está llena
+            // se espera al escritor
+            if (!pipeline_has_space(&pipe))
+            {
+                pipeline_sleep(&pipe, pipe_receiver, pipeline_has_space);
+            }
+            const uint32_t start = pipe.tail & (pipe.depth - 1);
+            const uint32_t space = pipe.depth - (pipe.tail - __atomic_load_n(&pipe.head, __ATOMIC_SEQ_CST));
+            size_t count = batch_size < space ? batch_size : space;
+            count = count < pipe.depth - start ? count : pipe.depth - start;
+            batch_count = recv_file_chunks(sock_fd, &pipe.frames[start], recv_lengths, count, server_config);
+            for (int i = 0; i < batch_count; i++)
+            {
+                pipe.slots[start + i] = (PipeSlot){0};
+            }
+        }
+
+        const uint32_t batch_tail = pipe.tail;
+        for (int i = 0; i < batch_count && !done; i++)
+        {
+            Frame *const recv_frame = &pipe.frames[(batch_tail + i) & (pipe.depth - 1)];
+            PipeSlot *const slot = &pipe.slots[(batch_tail + i) & (pipe.depth - 1)];
+
+            // Si recibimos un cacho exitosamente...
+            if (recv_lengths[i] <= 0)
+            {
+                continue;
+            }
+            log_debug("[+] Mensaje recibido. Seqnum: %u, bytes: %zu\n", recv_frame->seqnum, recv_frame->items);
+            msg_counter++;
+
+            if (frame_verify(recv_frame, &payload_crc))
+            {
+                if (coin_flip(p_percent) == 0)
+                {
+                    log_debug("[-] Paquete descartado.\n");
+                    lost_packets++;
+                    continue;
+                }
+
+                // Sólo escribimos el cacho en caso de ser nuevo, caber en la ventana y tener
+                // el tamaño que le toca; el último frame (seqnum == chunk_count) trae el CRC
+                const uint32_t seqnum = recv_frame->seqnum;
+                const uint32_t offset = seqnum - expected;
+                const bool parity = (recv_frame->flags & FRAME_PARITY) != 0;
+                const bool in_order = parity || offset == 0;
+                const bool last = seqnum == chunk_count;
+                const bool compressed = (recv_frame->flags & FRAME_COMPRESSED) != 0;
+                const uint64_t position = (uint64_t)seqnum * payload_size;
+                const size_t chunk_size = last ? sizeof server_crc : file_length - position < payload_size ? file_length - position : payload_size;
+                int rebuilt = 0;
 
-#include <sys/socket.h>
-#include <sys/types.h>
+                // La paridad no se confirma: se guarda y, si ya alcanza, reconstruye su bloque
+                if (parity)
+                {
+                    if (fec.code.scheme != FEC_NONE && fec_store_parity(&fec, recv_frame, slot, expected, chunk_count, chunk_size))
+                    {
+                        rebuilt = fec_recover(&fec, seqnum / fec.code.k, slot, written, window_size, expected, &received_end, chunk_count);
+                    }
+                }
+                else if (offset < window_size && (mode == MODE_SR || offset == 0) && seqnum <= chunk_count &&
+                    !(written[seqnum / 64] & (1ULL << (seqnum % 64))) && last == ((recv_frame->flags & FRAME_LAST) != 0) &&
+                    (compressed ? !last && handshake->compress && recv_frame->items < chunk_size : recv_frame->items == chunk_size))
+                {
+                    // El escritor expande, escribe y marca el cacho en la bitácora. El CRC
+                    // del frame cubre lo que viajó; si venía comprimido, el escritor calcula
+                    // el del cacho completo
+                    compressed_frames += compressed;
+                    wire_bytes += last ? 0 : recv_frame->items;
+                    if (last)
+                    {
+                        memcpy(&server_crc, recv_frame->packet.data, sizeof server_crc);
+                        server_crc = ntohl(server_crc);
+                    }
+                    else
+                    {
+                        *slot = (PipeSlot){.position = base + position, .chunk_size = chunk_size, .crc = payload_crc, .write = true};
+                    }
+                    written[seqnum / 64] |= 1ULL << (seqnum % 64);
+                    received_end = (int32_t)(seqnum + 1 - received_end) > 0 ? seqnum + 1 : received_end;
 
-#include <netinet/in.h>
-#include <arpa/inet.h>
+                    // Este cacho puede completar lo que le faltaba a la paridad de su bloque
+                    if (fec.code.scheme != FEC_NONE && !last)
+                    {
+                        rebuilt = fec_recover(&fec, seqnum / fec.code.k, slot, written, window_size, expected, &received_end, chunk_count);
+                    }
+                }
 
-#include "crc32.h"
+                // Avanzamos sobre todos los cachos consecutivos ya recibidos
+                while (!done && (written[expected / 64] & (1ULL << (expected % 64))))
+                {
+                    done = expected == chunk_count;
+                    expected++;
+                }
+
+                // Confirmamos el frame recibido (seqnum) y el siguiente esperado (ack).
+                // Una paridad sólo cuenta si reconstruyó algo
+                if (parity && rebuilt == 0)
+                {
+                    continue;
+                }
+                ack_seqnum = parity ? ack_seqnum : seqnum;
+                if (unacked++ == 0)
+                {
+                    unacked_since_us = monotonic_us();
+                }
+                if (!in_order || expected != received_end)
+                {
+                    if (mode == MODE_SR)
+                    {
+                        ack_now = true;
+                    }
+                    else
+                    {
+                        ack_prepare(&send_frames[ack_count++], seqnum, (int32_t)expected, &rwnd_net, rwnd_bytes, FRAME_RWND);
+                        unacked = 0;
+                    }
+                }
+            }
+        }
+
+        // El lote pasa al escritor; al terminar se espera a que todo esté en el archivo
+        // y se combinan los CRC de los cachos en el del rango
+        pipeline_publish(&pipe, batch_tail + (uint32_t)batch_count);
+        rwnd_net = htons(pipeline_window(&pipe, window_size));
+        if ((done && !pipeline_flush(&pipe)) || __atomic_load_n(&pipe.failed, __ATOMIC_SEQ_CST))
+        {
+            printf("[-] No se pudo escribir en \"%s\".\n", filename);
+            exit(EXIT_FAILURE);
+        }
+        for (uint64_t seqnum = 0; done && seqnum < chunk_count; seqnum++)
+        {
+            const uint64_t position = seqnum * payload_size;
+            file_crc = crc32_combine(file_crc, chunk_crcs[seqnum], file_length - position < payload_size ? file_length - position : payload_size);
+        }
+        if (done && pipe.corrupt)
+        {
+            printf("[-] Un cacho comprimido no se pudo expandir.\n");
+        }
+
+        // Enviamos último ack (-1) al terminar, regresando al servidor el CRC del
+        // archivo que escribimos; si no, el ack que tengamos pendiente
+        if (done)
+        {
+            log_sync();
+            file_crc_net = htonl(file_crc);
+            ack_prepare(&send_frames[ack_count++], ack_seqnum, -1, &file_crc_net, sizeof file_crc_net, 0);
+
+            if (file_crc == server_crc && !pipe.corrupt)
+            {
+                printf("[+] Integridad verificada (CRC-32 %08x).\n", file_crc);
+            }
+            else
+            {
+                // Lo escrito de este rango no sirve para reanudar
+                printf("[-] El archivo está corrupto: CRC-32 %08x, el servidor envió %08x.\n", file_crc, server_crc);
+                journal_forget(journal, base / payload_size, chunk_count);
+            }
+
+            // Imprimimos información sobre el archivo obtenido
+            printf("[+] Obtención de archivo \"%s\" finalizada!\n", filename);
+            printf("Nombre del archivo: %s\n", filename);
+            printf("Tamaño del archivo: %llu bytes.\n", (unsigned long long)file_length);
+            printf("Tamaño del buffer: %zu bytes.\n", payload_size);
+            printf("Modo: %s, ventana: %u frames.\n", mode_name(mode), window_size);
+            printf("Total de mensajes recibidos (DATA): %d.\n", msg_counter);
+            printf("Mensajes escritos (DATA): %u.\n", expected);
+            printf("Total de mensajes perdidos: %d.\n", lost_packets);
+            printf("Escrituras: %s, en un hilo aparte.\n", pipe.engine);
+            if (fec.code.scheme != FEC_NONE)
+            {
+                char fec_name[32];
+                fec_format(&fec.code, fec_name, sizeof fec_name);
+                printf("FEC %s: %d frames de paridad guardados, %d cachos reconstruidos.\n", fec_name, fec.received, fec.recovered);
+            }
+            if (handshake->compress)
+            {
+                printf("Comprimidos con LZ4: %d frames, %llu bytes en %llu (razón %.2f).\n", compressed_frames, (unsigned long long)file_length,
+                       (unsigned long long)wire_bytes, wire_bytes > 0 ? (double)file_length / (double)wire_bytes : 1.0);
+            }
+            printf("Total de confirmaciones enviadas (ACK): %d.\n", ack_counter + (int)ack_count);
+        }
+        else if (unacked > 0 && (ack_now || unacked >= ack_every))
+        {
+            const size_t sack_size = mode == MODE_SR ? sack_fill(sack, written, expected, window_size, chunk_count) : 0;
+            memcpy(sack + sack_size, &rwnd_net, rwnd_bytes);
+            ack_prepare(&send_frames[ack_count++], ack_seqnum, (int32_t)expected, sack, sack_size + rwnd_bytes,
+                        (sack_size > 0 ? FRAME_SACK : 0) | FRAME_RWND);
+            unacked = 0;
+        }
+
+        // Los acks del lote salen juntos
+        if (ack_count > 0)
+        {
+            for (size_t i = 0; i < ack_count; i++)
+            {
+                frame_seal(&send_frames[i]);
+            }
+            send_acks(sock_fd, send_batch, ack_count, server_config);
+            for (size_t i = 0; i < ack_count; i++)
+            {
+                log_debug("[+] Mensaje enviado. Ack: %d, bytes: %zu\n", send_frames[i].ack, send_frames[i].items);
+            }
+            ack_counter += (int)ack_count;
+        }
+    } while (!done);
+
+    const bool corrupt = pipe.corrupt;
+    pipeline_stop(&pipe);
+    free(written);
+    free(chunk_crcs);
+    fec_state_free(&fec);
+    close(sock_fd);
+    return file_crc == server_crc && !corrupt;
+}
+
+// Los rangos de una descarga, que los flujos se van repartiendo
+typedef struct {
+    const Range *ranges;
+    size_t count;
+    size_t next;                // siguiente rango sin dueño (atómico)
+}
+RangeQueue;
+
+// Un flujo de una descarga en paralelo: su propio socket pide rangos del archivo
+typedef struct {
+    pthread_t thread;
+    RangeQueue *queue;
+    const char *filename;
+    int fd;
+    size_t payload_size;
+    FileVersion version;        // la versión que anunció la primera respuesta
+    struct sockaddr_in server_config;
+    double p_percent;
+    Journal *journal;
+    bool ok;
+}
+Stream;
 
 /**
- * @brief Recibe un cacho del archivo enviado por el servidor.
- *        Esta llamada se bloquea hasta que los datos sean leídos.
+ * @brief Descarga un rango ("range=offset:length") en su lugar del archivo compartido,
+ *        con un socket nuevo.
  *
- * @param sock_fd el file descriptor del socket.
- * @param frame El frame (header)  cual escribir.
- * @param server_config La configuración del servidor.
- * @return El número de bytes leído en ok, -1 si error.
+ * @return true si el rango llegó íntegro.
  */
-static ssize_t recv_file_chunk(const int sock_fd, Frame *const frame, struct sockaddr_in *const server_config)
+static bool get_range(Stream *const stream, const Range *const range)
 {
-    socklen_t server_size = sizeof *server_config;
-    return recvfrom(sock_fd, frame, sizeof *frame, MSG_WAITALL, (struct sockaddr *)server_config, &server_size);
+    char message[1024];
+    char reply[1024];
+    Handshake handshake;
+
+    const int sock_fd = socket(PF_INET, SOCK_DGRAM, 0);
+    snprintf(message, sizeof message, "%s\nsize=%zu range=%llu:%llu", stream->filename, stream->payload_size,
+             (unsigned long long)range->offset, (unsigned long long)range->length);
+    if (sock_fd < 0 || request_file(sock_fd, message, reply, sizeof reply, &stream->server_config) < 0)
+    {
+        printf("[-] El servidor no respondió al rango %llu:%llu.\n", (unsigned long long)range->offset, (unsigned long long)range->length);
+        if (sock_fd >= 0)
+        {
+            close(sock_fd);
+        }
+        return false;
+    }
+    if (!parse_reply(reply, stream->payload_size, &handshake) || handshake.length != range->length || handshake.payload_size != stream->payload_size ||
+        handshake.version.sec != stream->version.sec || handshake.version.nsec != stream->version.nsec)
+    {
+        printf("[-] El servidor rechazó el rango %llu:%llu: %s\n", (unsigned long long)range->offset, (unsigned long long)range->length, reply);
+        close(sock_fd);
+        return false;
+    }
+    return get_file(sock_fd, stream->fd, stream->filename, range->offset, &stream->server_config, stream->p_percent, &handshake, stream->journal);
 }
 
 /**
- * @brief Escribe un cacho de archivo a un archivo.
- *
- * @param to El archivo hacia cuál escribir.
- * @param buffer El buffer a copiar.
- * @param buffer_size El tamaño del buffer en bytes.
+ * @brief Hilo de un flujo: toma rangos de la cola hasta que se acaban.
  */
-static size_t write_file_chunk(FILE *const to, const char *const buffer, const size_t buffer_size)
+static void *stream_main(void *const arg)
 {
-    return fwrite(buffer, sizeof(char), buffer_size, to);
+    Stream *const stream = arg;
+    size_t index;
+    while ((index = __atomic_fetch_add(&stream->queue->next, 1, __ATOMIC_RELAXED)) < stream->queue->count)
+    {
+        stream->ok = get_range(stream, &stream->queue->ranges[index]) && stream->ok;
+    }
+    return NULL;
 }
 
 /**
- * Envía un acknowledgement al servidor.
+ * @brief Descarga los rangos dados con hasta 'stream_count' flujos, cada uno con su
+ *        propio puerto, así que el servidor los reparte entre sus workers y el kernel
+ *        entre las colas de la NIC.
  *
- * @param sock_fd El file descriptor del socket.
- * @param frame El frame a ser enviado.
- * @param server_config La configuración del servidor.
+ * @return true si todos los rangos llegaron íntegros.
  */
-static void send_ack(const int sock_fd, const Frame *const frame, const struct sockaddr_in *const server_config)
+static bool get_file_streams(const int fd, const char *const filename, const Range *const ranges, const size_t range_count, const long stream_count,
+                             const size_t payload_size, const FileVersion version, const struct sockaddr_in *const server_config, const double p_percent,
+                             Journal *const journal)
 {
-    sendto(sock_fd, frame, sizeof *frame, 0, (struct sockaddr *)server_config, sizeof *server_config);
+    Stream streams[streams_max];
+    RangeQueue queue = {ranges, range_count, 0};
+    long started = 0;
+
+    while (started < stream_count && (size_t)started < range_count)
+    {
+        Stream *const stream = &streams[started];
+        stream->queue = &queue;
+        stream->filename = filename;
+        stream->fd = fd;
+        stream->payload_size = payload_size;
+        stream->version = version;
+        stream->server_config = *server_config;
+        stream->p_percent = p_percent;
+        stream->journal = journal;
+        stream->ok = true;
+        if (pthread_create(&stream->thread, NULL, stream_main, stream) != 0)
+        {
+            printf("[-] No se pudo iniciar el flujo %ld.\n", started);
+            break;
+        }
+        started++;
+    }
+
+    bool ok = started > 0 || range_count == 0;
+    for (long i = 0; i < started; i++)
+    {
+        pthread_join(streams[i].thread, NULL);
+        ok = ok && streams[i].ok;
+    }
+    printf("[%c] Descarga de %zu rangos en %ld flujos %s.\n", ok ? '+' : '-', range_count, started, ok ? "completa" : "incompleta");
+    return ok;
 }
 
 /**
- * @brief Descarga el archivo por su nombre dado.
+ * @brief Reparte 'total' bytes en 'count' rangos contiguos, múltiplos de la carga útil.
  *
- * @param sock_fd El file descriptor del socket.
- * @param filename El path del archivo destino.
- * @param server_config La configuración del servidor.
+ * @return Cuántos rangos resultaron (menos si no alcanzan los cachos).
  */
-static void get_file(const int sock_fd, const char *const filename, struct sockaddr_in *const server_config, double p_percent)
+static size_t split_ranges(const uint64_t total, const long count, const size_t payload_size, Range *const ranges)
 {
-    // Abrimos el archivo para escribir, sobreescribiendo si existe
-    printf("[+] Obteniendo archivo \"%s\"\n", filename);
-    FILE *const fp = fopen(filename, "w");
+    const uint64_t chunks = (total + payload_size - 1) / payload_size;
+    const uint64_t share = (chunks + (uint64_t)count - 1) / (uint64_t)count * payload_size;
+    size_t range_count = 0;
 
-    // Inicializamos en cero ambos frames
-    Frame recv_frame = {0};
-    Frame send_frame = {0};
-
-    int msg_counter = 0;
-    int ack_counter = 0;
-    int lost_packets = 0;
-    int crc = 0;
+    for (uint64_t offset = 0; offset < total; offset += share)
+    {
+        ranges[range_count++] = (Range){offset, total - offset < share ? total - offset : share};
+    }
+    return range_count;
+}
 
-    // Cambiamos a 'true' en la últime iteración
-    bool done = false;
-    do
+/**
+ * @brief Crea los directorios que faltan en el path de un archivo, como "mkdir -p".
+ */
+static bool make_parents(char *const path)
+{
+    for (char *slash = strchr(path, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
     {
-        // Si recibimos un cacho exitosamente...
-        if (recv_file_chunk(sock_fd, &recv_frame, server_config) > 0)
+        *slash = '\0';
+        const bool made = mkdir(path, 0755) == 0 || errno == EEXIST;
+        *slash = '/';
+        if (!made)
         {
-            printf("[+] Mensaje recibido. Seqnum: %d, bytes: %zu\n", recv_frame.seqnum, recv_frame.items);
-            msg_counter++;
+            return false;
+        }
+    }
+    return true;
+}
 
-            if (recv_frame.FCS == (crc32_buffer(buff_size, buff_size % 2, (const unsigned char*)recv_frame.packet.data)))
-            {
-                if (coin_flip(p_percent) == 0)
-                {
-                    printf("[-] Paquete descartado.\n");
-                    lost_packets++;
-                    continue;
-                }
+/**
+ * @brief Convierte el path que anuncia el servidor en uno relativo al directorio actual:
+ *        sin '/' al inicio y sin componentes "..", para que un lote no escriba fuera.
+ *
+ * @return El path, o NULL si no es aceptable.
+ */
+static char *batch_local_path(char *path)
+{
+    while (*path == '/' || strncmp(path, "./", 2) == 0)
+    {
+        path += *path == '/' ? 1 : 2;
+    }
+    for (const char *part = path; *part != '\0'; part = strchr(part, '/') != NULL ? strchr(part, '/') + 1 : part + strlen(part))
+    {
+        if (strncmp(part, "..", 2) == 0 && (part[2] == '/' || part[2] == '\0'))
+        {
+            return NULL;
+        }
+    }
+    return *path != '\0' ? path : NULL;
+}
 
-                //else
-                //{
-                    //printf("[+] Mensaje recibido. Seqnum: %d, bytes: %zu\n", recv_frame.seqnum, recv_frame.items);
-                    //msg_counter++;
+/**
+ * @brief Lee un número decimal del índice del lote: sólo dígitos, sin signo ni espacios
+ *        delante, y sin pasarse de 64 bits.
+ *
+ * @param text El primer dígito.
+ * @param end El final de la línea.
+ * @param value El número leído.
+ * @return El carácter siguiente al número, o NULL si no hay un número válido.
+ */
+static const char *batch_number(const char *text, const char *const end, uint64_t *const value)
+{
+    const char *const start = text;
+    *value = 0;
+    while (text < end && *text >= '0' && *text <= '9')
+    {
+        const unsigned digit = (unsigned)(*text - '0');
+        if (*value > (UINT64_MAX - digit) / 10)
+        {
+            return NULL;
+        }
+        *value = *value * 10 + digit;
+        text++;
+    }
+    return text > start ? text : NULL;
+}
 
-                    // Sólo escribimos el cacho en el archivo en caso de ser nuevo
-                    if (recv_frame.seqnum == send_frame.ack)
-                    {
-                        write_file_chunk(fp, recv_frame.packet.data, recv_frame.items);
-                        send_frame.ack = send_frame.ack ? 0 : 1;
-                    }
+/**
+ * @brief Lee una línea "<bytes> <path>" del índice del lote, sin aceptar nada más:
+ *        dígitos, un espacio y un path no vacío que termina en el salto de línea.
+ *
+ * @param line El inicio de la línea.
+ * @param next El salto de línea que la termina.
+ * @param size Los bytes del archivo.
+ * @param path El path, terminado en '\0'.
+ * @return true si la línea es válida.
+ */
+static bool batch_index_line(const char *const line, const char *const next, uint64_t *const size, char path[PATH_MAX])
+{
+    const char *const space = batch_number(line, next, size);
+    if (space == NULL || space == next || *space != ' ')
+    {
+        return false;
+    }
+    const size_t path_length = (size_t)(next - space - 1);
+    if (path_length == 0 || path_length >= PATH_MAX || memchr(space + 1, '\0', path_length) != NULL)
+    {
+        return false;
+    }
+    memcpy(path, space + 1, path_length);
+    path[path_length] = '\0';
+    return true;
+}
 
-                    // Enviamos último ack (-1) con esta condición
-                    if (recv_frame.items < buff_size)
-                    {
-                        done = true;
-                        send_frame.ack = -1;
-
-                        // Imprimimos información sobre el archivo obtenido
-                        printf("[+] Obtención de archivo \"%s\" finalizada!\n", filename);
-                        printf("Nombre del archivo: %s\n", filename);
-                        printf("Tamaño del archivo: %zu bytes.\n", get_file_size(fp));
-                        printf("Tamaño del buffer: %d bytes.\n", buff_size);
-                        printf("Total de mensajes recibidos (DATA): %d.\n", msg_counter);
-                        printf("Mensajes escritos (DATA): %d.\n", msg_counter - lost_packets);
-                        printf("Total de mensajes perdidos: %d.\n", lost_packets);
-                        printf("Total de confirmaciones enviadas (ACK): %d.\n", ack_counter);
-                    }
+/**
+ * @brief Separa un lote ya descargado en sus archivos. El lote empieza con un índice de
+ *        texto ("SWBATCH1 <archivos>" y luego "<bytes> <path>" por archivo), seguido
+ *        del contenido de cada archivo en el mismo orden. Los que ya existen no se tocan.
+ *
+ * @param fd El archivo temporal con el lote.
+ * @param length Los bytes del lote.
+ * @param files Los archivos que anunció el servidor.
+ * @return true si se crearon (o ya existían) todos los archivos del índice.
+ */
+static bool unpack_batch(const int fd, const uint64_t length, const size_t files)
+{
+    char *const map = length > 0 ? mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if (map == MAP_FAILED)
+    {
+        printf("[-] No se pudo leer el lote.\n");
+        return false;
+    }
 
-                    send_ack(sock_fd, &send_frame, server_config);
-                    printf("[+] Mensaje enviado. Ack: %d, bytes: %zu\n", send_frame.ack, send_frame.items);
-                    ack_counter++;
-                //}
-            }
+    // Primero se recorre el índice, para saber dónde empieza el contenido
+    const char *const end = map + length;
+    const char *line = memchr(map, '\n', length);
+    size_t count = 0;
+    uint64_t content = 0;
+    uint64_t announced = 0;
+    char path[PATH_MAX];
+    if (line == NULL || length <= sizeof batch_magic || strncmp(map, batch_magic " ", sizeof batch_magic) != 0 ||
+        batch_number(map + sizeof batch_magic, line, &announced) != line || announced != files)
+    {
+        printf("[-] El lote no trae un índice valido.\n");
+        munmap(map, length);
+        return false;
+    }
+    for (line++; count < files && line < end; count++)
+    {
+        const char *const next = memchr(line, '\n', (size_t)(end - line));
+        uint64_t size;
+        if (next == NULL || !batch_index_line(line, next, &size, path) || size > length - content)
+        {
+            break;
         }
+        content += size;
+        line = next + 1;
+    }
+    const uint64_t index_size = (uint64_t)(line - map);
+    if (count != files || content != length - index_size)
+    {
+        printf("[-] El índice del lote no coincide con su contenido.\n");
+        munmap(map, length);
+        return false;
+    }
 
-    } while (!done);
+    size_t created = 0;
+    size_t skipped = 0;
+    uint64_t position = index_size;
+    line = memchr(map, '\n', length) + 1;
+    for (size_t i = 0; i < files; i++)
+    {
+        // El índice ya se validó entero; se vuelve a leer igual de estricto antes de escribir
+        const char *const next = memchr(line, '\n', (size_t)(end - line));
+        uint64_t size;
+        if (next == NULL || !batch_index_line(line, next, &size, path) || size > length - position)
+        {
+            printf("[-] El índice del lote no coincide con su contenido.\n");
+            break;
+        }
+        line = next + 1;
 
-    close(sock_fd);
-    fclose(fp);
+        char *const local = batch_local_path(path);
+        int out = -1;
+        if (local != NULL && make_parents(local))
+        {
+            out = open(local, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        }
+        if (out < 0)
+        {
+            const int error = local != NULL ? errno : 0;
+            printf("[-] Se omite \"%s\": %s.\n", path, local == NULL ? "path no permitido" : error == EEXIST ? "ya existe" : strerror(error));
+            skipped += error == EEXIST;
+        }
+        else if (!write_file_chunk(out, map + position, size, 0))
+        {
+            printf("[-] No se pudo escribir en \"%s\".\n", local);
+            close(out);
+        }
+        else
+        {
+            printf("[+] Archivo del lote: %s (%llu bytes).\n", local, (unsigned long long)size);
+            created++;
+            close(out);
+        }
+        position += size;
+    }
+    munmap(map, length);
+    printf("[+] Lote de %zu archivos: %zu creados, %zu ya existían.\n", files, created, skipped);
+    return created + skipped == files;
 }
 
 int main(int argc, char **argv)
@@ -145,7 +1478,6 @@ int main(int argc, char **argv)
     int port = 0;                  // puerto
     int sockfd = 0;                // socket
     struct sockaddr_in serverAddr; // estructura sockaddr_in ya definida
-    socklen_t addr_len = sizeof(serverAddr);
 
     sockfd = socket(PF_INET, SOCK_DGRAM, 0); // el socket
     memset(&serverAddr, '\0', sizeof(serverAddr));
@@ -157,8 +1489,14 @@ int main(int argc, char **argv)
     char *program_name = argv[0]; // almacenamos el nombre del programa
 
     double p_percent = 1;
+    long payload_size = size_default;
+    bool probe_mtu = false;
+    long stream_count = 1;
+    bool batch = false;
+    Journal journal;
+    bool resume = false;
 
-    while ((opt = getopt(argc, argv, short_options)) != -1)
+    while ((opt = getopt_long(argc, argv, short_options, long_options, NULL)) != -1)
     {
         switch (opt)
         {
@@ -184,6 +1522,30 @@ int main(int argc, char **argv)
                 p_percent = 1-(p_percent/100);
             }
             break;
+        case 's':
+            payload_size = strtol(optarg, NULL, 10);
+            if (payload_size < 1 || payload_size > (long)size_max)
+            {
+                printf("Carga útil no valida: %s\n", optarg);
+                usage(stdout, program_name);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'u':
+            probe_mtu = true;
+            break;
+        case 'n':
+            stream_count = strtol(optarg, NULL, 10);
+            if (stream_count < 1 || stream_count > streams_max)
+            {
+                printf("Número de flujos no valido: %s\n", optarg);
+                usage(stdout, program_name);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'b':
+            batch = true;
+            break;
         case ':':
             printf("Argumento %c no proporcionado\n", optopt);
             usage(stdout, program_name);
@@ -191,6 +1553,9 @@ int main(int argc, char **argv)
         case 'h':
             usage(stdout, program_name);
             exit(EXIT_SUCCESS);
+        case 'v':
+            log_level = LOG_DEBUG;
+            break;
         default:
             printf("Argumento desconocido: %c\n", optopt);
             usage(stdout, program_name);
@@ -198,15 +1563,66 @@ int main(int argc, char **argv)
         }
     }
 
+    // Los mensajes por paquete (-v) pasan por el registro en memoria
+    if (log_start(stdout) < 0)
+    {
+        printf("[-] No se pudo iniciar el registro; los mensajes saldrán directo.\n");
+    }
+
     // Revisamos si se proporcionaron los argumentos necesarios
-    if (port != 0 && filename != NULL)
+    if (port != 0 && filename != NULL && batch)
     {
-        if (check_file_exists(filename))
+        // Un lote llega completo en una sola transferencia: ni flujos ni bitácora
+        if (stream_count > 1)
+        {
+            printf("[-] Un lote se descarga en un solo flujo.\n");
+            stream_count = 1;
+        }
+        if (probe_mtu)
+        {
+            const size_t mtu_payload = path_mtu_payload(&serverAddr);
+            payload_size = mtu_payload > 0 ? (long)mtu_payload : payload_size;
+        }
+        snprintf(message, sizeof message, "%s\nsize=%ld batch=1", filename, payload_size);
+    }
+    else if (port != 0 && filename != NULL)
+    {
+        // Si quedó la bitácora, una descarga anterior se interrumpió: se reanuda con
+        // la misma carga útil para que los cachos coincidan
+        if (journal_open(&journal, filename))
+        {
+            resume = access(filename, F_OK) == 0;
+            if (resume)
+            {
+                payload_size = (long)journal.payload_size;
+                printf("[+] Reanudando la descarga de \"%s\".\n", filename);
+            }
+            else
+            {
+                journal_close(&journal, true);
+            }
+        }
+        if (!resume && check_file_exists(filename))
         {
             printf("File already exists. Aborting.\n");
             exit(EXIT_SUCCESS);
         }
-        sendto(sockfd, filename, strlen(filename), 0, (struct sockaddr *)&serverAddr, addr_len);
+
+        // Pedimos la carga útil más grande que no se fragmente en la ruta
+        if (probe_mtu && !resume)
+        {
+            const size_t mtu_payload = path_mtu_payload(&serverAddr);
+            if (mtu_payload > 0)
+            {
+                payload_size = (long)mtu_payload;
+                printf("[+] Carga útil ajustada al MTU de la ruta: %ld bytes.\n", payload_size);
+            }
+        }
+
+        // La solicitud lleva el path y, en la siguiente línea, la carga útil deseada.
+        // Con varios flujos, o al reanudar, se pide primero un rango vacío, sólo para
+        // conocer el tamaño
+        snprintf(message, sizeof message, "%s\nsize=%ld%s", filename, payload_size, stream_count > 1 || resume ? " range=0:0" : "");
     }
     else
     {
@@ -215,17 +1631,115 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    int reply_len = 0;
     char reply[1024];
-    reply_len = recvfrom(sockfd, reply, 1024, MSG_WAITALL, (struct sockaddr *)&serverAddr, &addr_len);
-    reply[reply_len] = '\0';
+    if (request_file(sockfd, message, reply, sizeof reply, &serverAddr) < 0)
+    {
+        printf("[-] El servidor no respondió.\n");
+        exit(EXIT_FAILURE);
+    }
     printf("%s\n", reply);
 
-    if (strcmp(reply, "200") == 0)
+    Handshake handshake;
+    if (batch && parse_reply(reply, (size_t)payload_size, &handshake))
+    {
+        // El lote se recibe en un archivo temporal sin nombre y luego se separa
+        int spool = open(".", O_TMPFILE | O_RDWR, 0600);
+        if (spool < 0)
+        {
+            char spool_name[] = ".batch-XXXXXX";
+            spool = mkstemp(spool_name);
+            if (spool >= 0)
+            {
+                unlink(spool_name);
+            }
+        }
+        if (spool < 0 || handshake.batch_files == 0)
+        {
+            printf("[-] No se pudo recibir el lote \"%s\".\n", filename);
+            exit(EXIT_FAILURE);
+        }
+        reserve_output(spool, filename, handshake.total);
+        const bool ok = get_file(sockfd, spool, filename, 0, &serverAddr, p_percent, &handshake, NULL) &&
+                        unpack_batch(spool, handshake.length, handshake.batch_files);
+        close(spool);
+        exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    else if (parse_reply(reply, (size_t)payload_size, &handshake))
     {
-        get_file(sockfd, filename, &serverAddr, p_percent);
+        const bool probed = stream_count > 1 || resume;
+        int fd;
+        if (resume)
+        {
+            fd = open(filename, O_RDWR);
+            if (fd < 0)
+            {
+                printf("[-] No se pudo abrir \"%s\" para escribir.\n", filename);
+                exit(EXIT_FAILURE);
+            }
+
+            // Si el archivo cambió en el servidor, lo que tenemos ya no sirve
+            if (handshake.total != journal.total || handshake.payload_size != journal.payload_size ||
+                handshake.version.sec != journal.version.sec || handshake.version.nsec != journal.version.nsec)
+            {
+                printf("[-] \"%s\" cambió en el servidor; se descarga completo de nuevo.\n", filename);
+                journal_close(&journal, true);
+                resume = false;
+                if (ftruncate(fd, 0) < 0)
+                {
+                    printf("[-] No se pudo truncar \"%s\".\n", filename);
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+        else
+        {
+            fd = open_output(filename);
+        }
+        reserve_output(fd, filename, handshake.total);
+
+        // Sin bitácora la descarga funciona igual, sólo que no se puede reanudar
+        Journal *progress = &journal;
+        if (!resume && !journal_create(&journal, filename, handshake.total, handshake.payload_size, handshake.version))
+        {
+            printf("[-] No se pudo crear la bitácora de \"%s\"; la descarga no se podrá reanudar.\n", filename);
+            progress = NULL;
+        }
+        if (progress != NULL)
+        {
+            journal_attach(progress, fd);
+        }
+        if (resume)
+        {
+            const uint64_t valid = journal_verify(progress);
+            printf("[+] %llu de %llu cachos ya estaban escritos.\n", (unsigned long long)valid, (unsigned long long)journal.chunks);
+        }
 
-        exit(EXIT_SUCCESS);
+        // La respuesta al rango vacío también termina con su frame final, que hay que confirmar
+        bool ok = get_file(sockfd, fd, filename, 0, &serverAddr, p_percent, &handshake, progress);
+        if (ok && probed && handshake.total > 0)
+        {
+            // Al reanudar se piden sólo los huecos; si no, el archivo en partes iguales
+            Range *ranges = NULL;
+            size_t range_count = 0;
+            const bool listed = resume ? journal_missing(progress, &ranges, &range_count) : (ranges = malloc(stream_count * sizeof *ranges)) != NULL;
+            if (!listed)
+            {
+                printf("[-] No se pudo reservar la lista de rangos.\n");
+                exit(EXIT_FAILURE);
+            }
+            if (!resume)
+            {
+                range_count = split_ranges(handshake.total, stream_count, handshake.payload_size, ranges);
+            }
+            ok = get_file_streams(fd, filename, ranges, range_count, stream_count, handshake.payload_size, handshake.version, &serverAddr, p_percent, progress);
+            free(ranges);
+        }
+        if (progress != NULL)
+        {
+            journal_close(progress, ok);
+        }
+        close(fd);
+        exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
     }
 
     return 0;
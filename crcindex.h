@@ -0,0 +1,192 @@
+#ifndef __CRCINDEX_H
+#define __CRCINDEX_H
+
+// Índice de CRC de un archivo servido, junto a él ("<archivo>.<carga útil>.crcidx").
+// Guarda el CRC-32 de cada cacho de 'payload_size' bytes y el del archivo completo, así
+// que enviar (o verificar) un archivo que no cambió no vuelve a recorrerlo para calcularlos.
+// La cabecera guarda la identidad del archivo (tamaño, inodo y fecha de modificación):
+// si no coincide con la del archivo el índice no se usa.
+// En disco: la cabecera (CrcIndexHeader) y luego un CRC por cacho.
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crc32.h"
+
+#define crc_index_magic "SWCRCIDX1"
+#define crc_index_min_size (1 << 20)   // los archivos más chicos no llevan índice
+
+typedef struct {
+    char magic[12];
+    uint64_t size;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t payload_size;
+    uint32_t file_crc;
+    uint32_t reserved;
+}
+CrcIndexHeader;
+
+typedef struct {
+    void *map;                 // el índice mapeado completo, o NULL
+    size_t map_size;
+    const CrcIndexHeader *header;
+    const uint32_t *crcs;
+}
+CrcIndex;
+
+// declaraciones de funciones
+bool crc_index_open(CrcIndex *index, const char *filename, size_t payload_size, const struct stat *file_stat);
+bool crc_index_write(const char *filename, size_t payload_size, const struct stat *file_stat, const uint32_t *crcs);
+bool crc_index_build(const char *filename, size_t payload_size);
+void crc_index_close(CrcIndex *index);
+
+static void crc_index_path(char *path, size_t path_size, const char *filename, size_t payload_size)
+{
+    snprintf(path, path_size, "%s.%zu.crcidx", filename, payload_size);
+}
+
+static uint64_t crc_index_chunks(uint64_t size, size_t payload_size)
+{
+    return (size + payload_size - 1) / payload_size;
+}
+
+static bool crc_index_matches(const CrcIndexHeader *header, size_t payload_size, const struct stat *file_stat)
+{
+    return memcmp(header->magic, crc_index_magic, sizeof crc_index_magic) == 0 && header->payload_size == payload_size &&
+           header->size == (uint64_t)file_stat->st_size && header->ino == (uint64_t)file_stat->st_ino &&
+           header->mtime_sec == (int64_t)file_stat->st_mtim.tv_sec && header->mtime_nsec == (int64_t)file_stat->st_mtim.tv_nsec;
+}
+
+// Mapea el índice de 'filename' para cachos de 'payload_size' bytes. Regresa false si no
+// hay, está incompleto o describe otra versión del archivo
+bool crc_index_open(CrcIndex *index, const char *filename, size_t payload_size, const struct stat *file_stat)
+{
+    char path[1100];
+    struct stat index_stat;
+    memset(index, 0, sizeof *index);
+    if (payload_size == 0)
+    {
+        return false;
+    }
+    crc_index_path(path, sizeof path, filename, payload_size);
+
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    const size_t expected = sizeof(CrcIndexHeader) + crc_index_chunks((uint64_t)file_stat->st_size, payload_size) * sizeof(uint32_t);
+    void *const map = fstat(fd, &index_stat) == 0 && (size_t)index_stat.st_size == expected ? mmap(NULL, expected, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+    if (!crc_index_matches(map, payload_size, file_stat))
+    {
+        munmap(map, expected);
+        return false;
+    }
+    index->map = map;
+    index->map_size = expected;
+    index->header = map;
+    index->crcs = (const uint32_t *)((const char *)map + sizeof(CrcIndexHeader));
+    return true;
+}
+
+// Escribe el índice de 'filename' a partir de los CRC de cada cacho; el del archivo
+// completo se obtiene combinándolos. Se escribe a un temporal único (varios workers
+// pueden terminar el mismo archivo a la vez) y se renombra, así que quien lo lea
+// nunca ve un índice a medias
+bool crc_index_write(const char *filename, size_t payload_size, const struct stat *file_stat, const uint32_t *crcs)
+{
+    char path[1100];
+    char temp_path[1110];
+    const uint64_t chunks = crc_index_chunks((uint64_t)file_stat->st_size, payload_size);
+    CrcIndexHeader header = {{0}, (uint64_t)file_stat->st_size, (uint64_t)file_stat->st_ino, (int64_t)file_stat->st_mtim.tv_sec,
+                             (int64_t)file_stat->st_mtim.tv_nsec, payload_size, 0, 0};
+    memcpy(header.magic, crc_index_magic, sizeof crc_index_magic);
+    for (uint64_t chunk = 0; chunk < chunks; chunk++)
+    {
+        const uint64_t position = chunk * payload_size;
+        const uint64_t size = header.size - position < payload_size ? header.size - position : payload_size;
+        header.file_crc = crc32_combine(header.file_crc, crcs[chunk], size);
+    }
+
+    crc_index_path(path, sizeof path, filename, payload_size);
+    snprintf(temp_path, sizeof temp_path, "%s.XXXXXX", path);
+    const int fd = mkstemp(temp_path);
+    if (fd < 0)
+    {
+        return false;
+    }
+    fchmod(fd, 0644);
+    const size_t crcs_size = chunks * sizeof *crcs;
+    const bool ok = write(fd, &header, sizeof header) == (ssize_t)sizeof header && write(fd, crcs, crcs_size) == (ssize_t)crcs_size;
+    if (close(fd) < 0 || !ok || rename(temp_path, path) < 0)
+    {
+        unlink(temp_path);
+        return false;
+    }
+    return true;
+}
+
+// Calcula y escribe el índice de 'filename' leyéndolo completo
+bool crc_index_build(const char *filename, size_t payload_size)
+{
+    struct stat file_stat;
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0 || payload_size == 0 || fstat(fd, &file_stat) < 0 || !S_ISREG(file_stat.st_mode))
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return false;
+    }
+
+    const uint64_t chunks = crc_index_chunks((uint64_t)file_stat.st_size, payload_size);
+    uint32_t *const crcs = calloc(chunks + 1, sizeof *crcs);
+    const unsigned char *const map = file_stat.st_size > 0 ? mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0) : NULL;
+    close(fd);
+    if (crcs == NULL || map == MAP_FAILED)
+    {
+        free(crcs);
+        return false;
+    }
+    madvise((void *)map, (size_t)file_stat.st_size, MADV_SEQUENTIAL);
+    for (uint64_t chunk = 0; chunk < chunks; chunk++)
+    {
+        const uint64_t position = chunk * payload_size;
+        const uint64_t size = (uint64_t)file_stat.st_size - position < payload_size ? (uint64_t)file_stat.st_size - position : payload_size;
+        crcs[chunk] = crc32_update((unsigned int)size, 0, map + position);
+    }
+    if (map != NULL)
+    {
+        munmap((void *)map, (size_t)file_stat.st_size);
+    }
+
+    const bool ok = crc_index_write(filename, payload_size, &file_stat, crcs);
+    free(crcs);
+    return ok;
+}
+
+void crc_index_close(CrcIndex *index)
+{
+    if (index->map != NULL)
+    {
+        munmap(index->map, index->map_size);
+    }
+    memset(index, 0, sizeof *index);
+}
+
+#endif
@@ -0,0 +1,467 @@
+#ifndef __FEC_H
+#define __FEC_H
+
+// Corrección de errores hacia adelante: cada bloque de k frames de datos lleva m frames
+// de paridad, combinaciones lineales de los datos en GF(2^8) (polinomio 0x11d, generador 2).
+// Con e <= m datos perdidos en un bloque, e paridades cualesquiera bastan para
+// reconstruirlos sin pedir nada al servidor. Un frame más corto cuenta como relleno con ceros.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#define fec_max_k 128
+#define fec_max_m 16
+
+// FEC_XOR: una sola paridad, el XOR del bloque (m = 1).
+// FEC_RS: Reed-Solomon sistemático con generador de Cauchy; la paridad j del dato i usa
+// 1 / (i + (255 - j)), así toda submatriz cuadrada es invertible y k + m <= 256
+typedef enum {
+    FEC_NONE,
+    FEC_XOR,
+    FEC_RS
+}
+FecScheme;
+
+typedef struct {
+    FecScheme scheme;
+    unsigned int k;            // frames de datos por bloque
+    unsigned int m;            // frames de paridad por bloque
+}
+FecCode;
+
+// dst ^= lo[src & 15] ^ hi[src >> 4], donde lo y hi tienen c por cada nibble bajo y alto
+typedef void (*FecKernel)(unsigned char *dst, const unsigned char *src,
+                          const unsigned char *lo, const unsigned char *hi, size_t nbytes);
+
+// declaraciones de funciones
+void fec_initialise(void) __attribute__((constructor));
+int fec_parse(FecCode *code, const char *text);
+int fec_format(const FecCode *code, char *text, size_t size);
+unsigned char fec_coefficient(const FecCode *code, unsigned int parity, unsigned int data);
+void fec_mul_add(unsigned char *dst, const unsigned char *src, unsigned char c, size_t nbytes);
+void fec_encode(const FecCode *code, unsigned int parity, const unsigned char *const *data,
+                const size_t *lengths, unsigned int count, unsigned char *out, size_t nbytes);
+int fec_decode(const FecCode *code, unsigned char *const *data, const unsigned char *present,
+               unsigned int count, unsigned char *const *parity, const unsigned int *parity_index,
+               unsigned int parity_count, size_t nbytes);
+const char *fec_kernel_name(void);
+int fec_selftest(void);
+
+// exp va duplicada para que un producto nunca necesite el módulo 255
+static unsigned char fec_exp[512];
+static unsigned char fec_log[256];
+
+static unsigned char fec_mul(unsigned char a, unsigned char b)
+{
+    return a && b ? fec_exp[fec_log[a] + fec_log[b]] : 0;
+}
+
+static unsigned char fec_inverse(unsigned char a)
+{
+    return fec_exp[255 - fec_log[a]];
+}
+
+static void fec_table(unsigned char *dst, const unsigned char *src,
+                      const unsigned char *lo, const unsigned char *hi, size_t nbytes)
+{
+    for (size_t i = 0; i < nbytes; i++)
+    {
+        dst[i] ^= lo[src[i] & 15] ^ hi[src[i] >> 4];
+    }
+}
+
+// Las tablas de 16 entradas son justo un PSHUFB (x86-64) o un TBL (ARMv8) por cada
+// 16 o 32 bytes
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static void fec_avx2(unsigned char *dst, const unsigned char *src,
+                     const unsigned char *lo, const unsigned char *hi, size_t nbytes)
+{
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    const __m256i tlo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)lo));
+    const __m256i thi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)hi));
+    size_t i;
+    for (i = 0; i + 32 <= nbytes; i += 32)
+    {
+        const __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+        const __m256i l = _mm256_shuffle_epi8(tlo, _mm256_and_si256(s, mask));
+        const __m256i h = _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask));
+        const __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(d, _mm256_xor_si256(l, h)));
+    }
+    fec_table(dst + i, src + i, lo, hi, nbytes - i);
+}
+
+static int fec_avx2_supported(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("ssse3")))
+static void fec_ssse3(unsigned char *dst, const unsigned char *src,
+                      const unsigned char *lo, const unsigned char *hi, size_t nbytes)
+{
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    const __m128i tlo = _mm_loadu_si128((const __m128i *)lo);
+    const __m128i thi = _mm_loadu_si128((const __m128i *)hi);
+    size_t i;
+    for (i = 0; i + 16 <= nbytes; i += 16)
+    {
+        const __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        const __m128i l = _mm_shuffle_epi8(tlo, _mm_and_si128(s, mask));
+        const __m128i h = _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+        const __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(d, _mm_xor_si128(l, h)));
+    }
+    fec_table(dst + i, src + i, lo, hi, nbytes - i);
+}
+
+static int fec_ssse3_supported(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3");
+}
+#endif
+
+#if defined(__aarch64__)
+// Advanced SIMD es obligatorio en ARMv8-A, así que este siempre se puede usar
+static void fec_neon(unsigned char *dst, const unsigned char *src,
+                     const unsigned char *lo, const unsigned char *hi, size_t nbytes)
+{
+    const uint8x16_t mask = vdupq_n_u8(0x0f);
+    const uint8x16_t tlo = vld1q_u8(lo);
+    const uint8x16_t thi = vld1q_u8(hi);
+    size_t i;
+    for (i = 0; i + 16 <= nbytes; i += 16)
+    {
+        const uint8x16_t s = vld1q_u8(src + i);
+        const uint8x16_t l = vqtbl1q_u8(tlo, vandq_u8(s, mask));
+        const uint8x16_t h = vqtbl1q_u8(thi, vshrq_n_u8(s, 4));
+        vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), veorq_u8(l, h)));
+    }
+    fec_table(dst + i, src + i, lo, hi, nbytes - i);
+}
+#endif
+
+// los kernels de esta arquitectura, del más rápido al más lento; el de tablas va al
+// final y siempre se puede usar
+static const struct {
+    const char *name;
+    FecKernel kernel;
+    int (*supported)(void);
+} fec_kernels[] = {
+#if defined(__x86_64__)
+    {"avx2", fec_avx2, fec_avx2_supported},
+    {"ssse3", fec_ssse3, fec_ssse3_supported},
+#elif defined(__aarch64__)
+    {"neon", fec_neon, NULL},
+#endif
+    {"table", fec_table, NULL},
+};
+
+#define fec_kernel_count (sizeof fec_kernels / sizeof fec_kernels[0])
+
+static unsigned int fec_selected = fec_kernel_count - 1;
+
+// arma las tablas del campo y elige el kernel; corre sola antes de main()
+void fec_initialise(void)
+{
+    unsigned int x = 1;
+    for (unsigned int i = 0; i < 255; i++)
+    {
+        fec_exp[i] = fec_exp[i + 255] = (unsigned char)x;
+        fec_log[x] = (unsigned char)i;
+        x <<= 1;
+        if (x & 0x100)
+        {
+            x ^= 0x11d;
+        }
+    }
+
+    for (unsigned int i = 0; i < fec_kernel_count; i++)
+    {
+        if (fec_kernels[i].supported == NULL || fec_kernels[i].supported())
+        {
+            fec_selected = i;
+            return;
+        }
+    }
+}
+
+static void fec_mul_add_with(FecKernel kernel, unsigned char *dst, const unsigned char *src,
+                             unsigned char c, size_t nbytes)
+{
+    if (c == 0)
+    {
+        return;
+    }
+    unsigned char lo[16], hi[16];
+    for (unsigned int i = 0; i < 16; i++)
+    {
+        lo[i] = fec_mul(c, (unsigned char)i);
+        hi[i] = fec_mul(c, (unsigned char)(i << 4));
+    }
+    kernel(dst, src, lo, hi, nbytes);
+}
+
+// dst ^= c * src sobre todo un frame; aquí se va casi todo el tiempo
+void fec_mul_add(unsigned char *dst, const unsigned char *src, unsigned char c, size_t nbytes)
+{
+    fec_mul_add_with(fec_kernels[fec_selected].kernel, dst, src, c, nbytes);
+}
+
+// "xor:K" o "rs:K:M" (M es 1 si no se da); -1 si el texto no es un código válido
+int fec_parse(FecCode *code, const char *text)
+{
+    char scheme[4];
+    unsigned int k, m = 1;
+    const int fields = sscanf(text, "%3[a-z]:%u:%u", scheme, &k, &m);
+    if (fields < 2)
+    {
+        return -1;
+    }
+    if (strcmp(scheme, "xor") == 0 && m == 1)
+    {
+        code->scheme = FEC_XOR;
+    }
+    else if (strcmp(scheme, "rs") == 0)
+    {
+        code->scheme = FEC_RS;
+    }
+    else
+    {
+        return -1;
+    }
+    if (k < 1 || k > fec_max_k || m < 1 || m > fec_max_m)
+    {
+        return -1;
+    }
+    code->k = k;
+    code->m = m;
+    return 0;
+}
+
+// lo inverso de fec_parse(), siempre con los tres campos
+int fec_format(const FecCode *code, char *text, size_t size)
+{
+    return snprintf(text, size, "%s:%u:%u", code->scheme == FEC_XOR ? "xor" : "rs", code->k, code->m);
+}
+
+unsigned char fec_coefficient(const FecCode *code, unsigned int parity, unsigned int data)
+{
+    if (code->scheme == FEC_XOR)
+    {
+        return 1;
+    }
+    return fec_inverse((unsigned char)(data ^ (255 - parity)));
+}
+
+// la paridad 'parity' de los primeros 'count' datos de un bloque, de lengths[i] <= nbytes
+// bytes cada uno, en 'out' (nbytes bytes)
+void fec_encode(const FecCode *code, unsigned int parity, const unsigned char *const *data,
+                const size_t *lengths, unsigned int count, unsigned char *out, size_t nbytes)
+{
+    memset(out, 0, nbytes);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        fec_mul_add(out, data[i], fec_coefficient(code, parity, i), lengths[i]);
+    }
+}
+
+// Reconstruye los datos de un bloque que no están en present[]. data[i] apunta a nbytes
+// bytes por frame: el frame rellenado si está, el lugar del resultado si no. parity[r] es
+// la paridad parity_index[r] y se sobreescribe. Regresa cuántos frames reconstruyó, o -1
+// si hay menos paridades que datos perdidos
+int fec_decode(const FecCode *code, unsigned char *const *data, const unsigned char *present,
+               unsigned int count, unsigned char *const *parity, const unsigned int *parity_index,
+               unsigned int parity_count, size_t nbytes)
+{
+    unsigned char a[fec_max_m][fec_max_m], inv[fec_max_m][fec_max_m], scale, t;
+    unsigned int missing[fec_max_m], e = 0;
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (!present[i])
+        {
+            if (e == parity_count || e == fec_max_m)
+            {
+                return -1;
+            }
+            missing[e++] = i;
+        }
+    }
+    if (e == 0)
+    {
+        return 0;
+    }
+
+    // Se quitan los datos conocidos de las primeras e paridades
+    for (unsigned int r = 0; r < e; r++)
+    {
+        for (unsigned int i = 0; i < count; i++)
+        {
+            if (present[i])
+            {
+                fec_mul_add(parity[r], data[i], fec_coefficient(code, parity_index[r], i), nbytes);
+            }
+        }
+    }
+
+    // Lo que queda es a[r][c] * missing[c]; a se invierte con Gauss-Jordan
+    for (unsigned int r = 0; r < e; r++)
+    {
+        for (unsigned int c = 0; c < e; c++)
+        {
+            a[r][c] = fec_coefficient(code, parity_index[r], missing[c]);
+            inv[r][c] = r == c;
+        }
+    }
+    for (unsigned int c = 0; c < e; c++)
+    {
+        unsigned int p = c;
+        while (p < e && a[p][c] == 0)
+        {
+            p++;
+        }
+        if (p == e)
+        {
+            return -1;
+        }
+        for (unsigned int i = 0; i < e; i++)
+        {
+            t = a[c][i]; a[c][i] = a[p][i]; a[p][i] = t;
+            t = inv[c][i]; inv[c][i] = inv[p][i]; inv[p][i] = t;
+        }
+        scale = fec_inverse(a[c][c]);
+        for (unsigned int i = 0; i < e; i++)
+        {
+            a[c][i] = fec_mul(a[c][i], scale);
+            inv[c][i] = fec_mul(inv[c][i], scale);
+        }
+        for (unsigned int r = 0; r < e; r++)
+        {
+            if (r == c || a[r][c] == 0)
+            {
+                continue;
+            }
+            scale = a[r][c];
+            for (unsigned int i = 0; i < e; i++)
+            {
+                a[r][i] ^= fec_mul(a[c][i], scale);
+                inv[r][i] ^= fec_mul(inv[c][i], scale);
+            }
+        }
+    }
+
+    for (unsigned int c = 0; c < e; c++)
+    {
+        memset(data[missing[c]], 0, nbytes);
+        for (unsigned int r = 0; r < e; r++)
+        {
+            fec_mul_add(data[missing[c]], parity[r], inv[c][r], nbytes);
+        }
+    }
+    return (int)e;
+}
+
+const char *fec_kernel_name(void)
+{
+    return fec_kernels[fec_selected].name;
+}
+
+// Compara cada kernel disponible con el de tablas para todo multiplicador y varios
+// largos; luego codifica bloques al azar, pierde tantos datos como paridades hay y
+// revisa que vuelvan. Regresa cuántas diferencias encontró
+int fec_selftest(void)
+{
+    enum { frame = 300, k = 10, m = 4 };
+    static unsigned char src[frame], expected[frame], got[frame];
+    static unsigned char data[k][frame], parity[m][frame], saved[k][frame];
+    static const FecCode codes[] = {{FEC_XOR, k, 1}, {FEC_RS, k, m}};
+    unsigned char *data_ptr[k], *parity_ptr[m], present[k];
+    const unsigned char *const_ptr[k];
+    size_t lengths[k];
+    unsigned int index[m], random = 1, failures = 0;
+
+    for (unsigned int i = 0; i < frame; i++)
+    {
+        random = random * 1103515245 + 12345;
+        src[i] = (unsigned char)(random >> 16);
+    }
+    for (unsigned int i = 0; i < fec_kernel_count; i++)
+    {
+        if (fec_kernels[i].supported != NULL && !fec_kernels[i].supported())
+        {
+            continue;
+        }
+        for (unsigned int c = 0; c < 256; c++)
+        {
+            for (unsigned int len = 0; len <= 256; len += 17)
+            {
+                memset(expected, (int)c, frame);
+                memcpy(got, expected, frame);
+                fec_mul_add_with(fec_table, expected, src, (unsigned char)c, len);
+                fec_mul_add_with(fec_kernels[i].kernel, got, src, (unsigned char)c, len);
+                failures += memcmp(expected, got, frame) != 0;
+            }
+        }
+    }
+
+    for (unsigned int c = 0; c < sizeof codes / sizeof codes[0]; c++)
+    {
+        for (unsigned int i = 0; i < k; i++)
+        {
+            for (unsigned int j = 0; j < frame; j++)
+            {
+                random = random * 1103515245 + 12345;
+                data[i][j] = (unsigned char)(random >> 16);
+            }
+            // El último frame es corto y cuenta como relleno con ceros
+            lengths[i] = i == k - 1 ? frame / 2 : frame;
+            memset(data[i] + lengths[i], 0, frame - lengths[i]);
+            memcpy(saved[i], data[i], frame);
+            data_ptr[i] = data[i];
+            const_ptr[i] = data[i];
+        }
+        for (unsigned int j = 0; j < codes[c].m; j++)
+        {
+            fec_encode(&codes[c], j, const_ptr, lengths, k, parity[j], frame);
+        }
+
+        // Se pierden el último frame y los primeros m - 1; se recuperan con las últimas paridades
+        for (unsigned int i = 0; i < k; i++)
+        {
+            present[i] = !(i == k - 1 || i + 1 < codes[c].m);
+            if (!present[i])
+            {
+                memset(data[i], 0xa5, frame);
+            }
+        }
+        for (unsigned int j = 0; j < codes[c].m; j++)
+        {
+            parity_ptr[j] = parity[codes[c].m - 1 - j];
+            index[j] = codes[c].m - 1 - j;
+        }
+        if (fec_decode(&codes[c], data_ptr, present, k, parity_ptr, index, codes[c].m, frame) != (int)codes[c].m)
+        {
+            failures++;
+        }
+        for (unsigned int i = 0; i < k; i++)
+        {
+            failures += memcmp(data[i], saved[i], frame) != 0;
+        }
+    }
+    return (int)failures;
+}
+
+#endif
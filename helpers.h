@@ -5,13 +5,26 @@
 #include <stdbool.h>
 #include <string.h>
 #include <time.h>
+#include <stddef.h>
 
-#define buff_size 512
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "crc32.h"
+
+#define size_default 4096
+#define size_max (65507 - sizeof(FrameHeader)) // máximo datagrama UDP sobre IPv4
 #define time_default 1000
+#define window_default 8
+#define frame_batch_max 64 // frames por llamada a sendmmsg/recvmmsg (y segmentos por envío GSO)
 
 // variable opt y string y struct para manejar los command line arguments
 int opt;
-const char *const short_options = ":e:l:i:p:f:t:s:hv";
+const char *const short_options = ":e:l:i:p:f:t:s:m:w:un:bW:PzCM:Ic:F:Hhv";
 const struct option long_options[] = {
     {"errpr", 1, NULL, 'e'},
     {"lost", 1, NULL, 'l'},
@@ -19,29 +32,79 @@ const struct option long_options[] = {
     {"port", 1, NULL, 'p'},
     {"file", 1, NULL, 'f'},
     {"size", 1, NULL, 's'},
+    {"timeout", 1, NULL, 't'},
+    {"mode", 1, NULL, 'm'},
+    {"window", 1, NULL, 'w'},
+    {"mtu", 0, NULL, 'u'},
+    {"streams", 1, NULL, 'n'},
+    {"batch", 0, NULL, 'b'},
+    {"workers", 1, NULL, 'W'},
+    {"pin", 0, NULL, 'P'},
+    {"zerocopy", 0, NULL, 'z'},
+    {"compress", 0, NULL, 'C'},
+    {"cache", 1, NULL, 'M'},
+    {"index", 0, NULL, 'I'},
+    {"cc", 1, NULL, 'c'},
+    {"fec", 1, NULL, 'F'},
+    {"hugepages", 0, NULL, 'H'},
     {"help", 0, NULL, 'h'},
     {"verbose", 0, NULL, 'v'},
     {NULL, 0, NULL, 0}};
 
+// buffer de la carga útil; su tamaño se negocia en el handshake
 typedef struct {
-    char data[buff_size];
+    char *data;
+    size_t size;
 }
 Packet;
 
+// modos de ARQ soportados; stop-and-wait equivale a una ventana de 1
+typedef enum {
+    MODE_SW,
+    MODE_GBN,
+    MODE_SR
+}
+ArqMode;
+
+// banderas de un frame
+#define FRAME_LAST 0x0001 // fin del archivo: la carga útil es el CRC-32 del archivo completo
+#define FRAME_SACK 0x0002 // ack selectivo: la carga útil es un mapa de bits de los frames
+                          // recibidos después de 'ack'; el bit i corresponde a ack + 1 + i
+#define sack_bytes_max 128 // mapa SACK de una ventana de hasta 1024 frames
+#define FRAME_PARITY 0x0004 // paridad FEC del bloque que empieza en 'seqnum'; 'ack' es su índice
+#define FRAME_COMPRESSED 0x0008 // la carga útil es un bloque LZ4 con el cacho completo
+#define FRAME_RWND 0x0010 // el ack anuncia la ventana del cliente: los últimos 2 bytes de la carga
+                          // útil (en orden de red) son los frames que acepta a partir de 'ack'
+#define rwnd_bytes 2
+
+// cabecera de un frame tal como viaja por la red: empaquetada, en orden de red
+// y seguida únicamente de los 'length' bytes válidos de la carga útil.
+// No depende del acomodo que el compilador le dé a Frame en cada host.
+typedef struct __attribute__((packed)) {
+    uint32_t seqnum;
+    uint32_t ack;
+    uint16_t length;
+    uint16_t flags;
+    uint32_t FCS;
+}
+FrameHeader;
 
 // struct para mensajes de datos
+// 'seqnum' es el índice del cacho dentro del archivo y 'ack' el siguiente
+// seqnum esperado por el cliente (acumulativo), o -1 al terminar
 typedef struct {
-    int seqnum;
-    int ack;
+    uint32_t seqnum;
+    int32_t ack;
     Packet packet;
     size_t items;
+    uint16_t flags;
     uint32_t FCS;
+    FrameHeader wire; // cabecera empaquetada por frame_send_batch(); vive tanto como el frame
 }
 Frame;
 
 // declaraciones de funciones
 static int coin_flip(double percent);
-static size_t get_file_size(FILE* const from);
 char flip_char(char character);
 bool check_file_exists(const char *spath);
 int get_argc(const char *string);
@@ -49,6 +112,26 @@ void get_argv(char **words, char *string);
 void usage(FILE *stream, char program_name[]);
 void send_command(char command[]);
 int word_coint(char string[]);
+ArqMode parse_mode(const char *string);
+const char *mode_name(ArqMode mode);
+const char *handshake_value(const char *message, const char *key);
+long elapsed_us(const struct timespec *since);
+long monotonic_us(void);
+bool packet_alloc(Packet *packet, size_t size);
+void packet_free(Packet *packet);
+size_t path_mtu_payload(const struct sockaddr_in *to);
+void frame_header_pack(const Frame *frame, FrameHeader *header);
+bool frame_header_unpack(Frame *frame, const FrameHeader *header, size_t bytes);
+bool frame_decode(Frame *frame, char *buffer, size_t bytes);
+uint32_t frame_seal(Frame *frame);
+void frame_seal_crc(Frame *frame, uint32_t payload_crc);
+bool frame_verify(const Frame *frame, uint32_t *payload_crc);
+ssize_t frame_send(int sock_fd, const Frame *frame, const struct sockaddr_in *to);
+ssize_t frame_recv(int sock_fd, Frame *frame, struct sockaddr_in *from);
+int frame_send_batch(int sock_fd, Frame *const *frames, size_t count, const struct sockaddr_in *to, int flags);
+size_t frame_gso_count(Frame *const *frames, size_t count);
+int frame_send_gso(int sock_fd, Frame *const *frames, size_t count, const struct sockaddr_in *to, int flags);
+int frame_recv_batch(int sock_fd, Frame *frames, ssize_t *lengths, size_t count, struct sockaddr_in *from);
 
 
 // Volado
@@ -65,14 +148,6 @@ int coin_flip(double percent) {
     }
 }
 
-// obtiene el tamaño de un archivo
-static size_t get_file_size(FILE* const from) {
-    fseek(from, 0, SEEK_END);
-    size_t size = ftell(from);
-    fseek(from, 0, SEEK_SET);
-    return size;
-}
-
 // comprueba si un archivo existe
 bool check_file_exists(const char *path)
 {
@@ -99,7 +174,22 @@ void usage(FILE *stream, char program_name[])
             " -i --ip <X.X.X.X>\t\t Dirección IPv4 (default: 127.0.0.1) [opcional].\n"
             " -p --port <0-65535>\t\t Puerto UDP (default: 4510) [opcional].\n"
             " -f --file <filename> \t\t Ruta del archivo [obligatorio].\n"
-            " -s --size <1-65535>\t\t Carga útil (default: 4096) [opcional].\n"
+            " -s --size <1-65491>\t\t Carga útil (default: 4096) [opcional].\n"
+            " -t --timeout <ms>\t\t Tiempo de espera inicial para retransmitir; luego se ajusta al RTT (default: 1000) [opcional].\n"
+            " -m --mode <sw|gbn|sr>\t\t Modo de ARQ: stop-and-wait, Go-Back-N o Selective Repeat (default: sw) [opcional].\n"
+            " -w --window <1-1024>\t\t Tamaño de la ventana en modos gbn y sr (default: 8) [opcional].\n"
+            " -u --mtu \t\t\t Ajusta la carga útil al MTU de la ruta para evitar fragmentación IP [opcional].\n"
+            " -n --streams <1-64>\t\t Descarga el archivo en N flujos paralelos, cada uno con un rango (default: 1) [opcional].\n"
+            " -b --batch \t\t\t Descarga en una sola sesión los archivos de un patrón (p. ej. 'logs/*.log' o '{a,b}') o directorio [opcional].\n"
+            " -W --workers <1-256>\t\t Hilos del servidor, cada uno con su socket SO_REUSEPORT (default: 1) [opcional].\n"
+            " -P --pin \t\t\t Fija cada worker del servidor a un CPU [opcional].\n"
+            " -z --zerocopy \t\t Envía las cargas grandes con MSG_ZEROCOPY desde el archivo mapeado [opcional].\n"
+            " -C --compress \t\t Comprime cada cacho con LZ4 en un hilo aparte; los que no se achican van tal cual [opcional].\n"
+            " -M --cache <MiB>\t\t Tamaño de la caché de archivos del servidor; 0 la desactiva (default: 256) [opcional].\n"
+            " -I --index <archivos...>\t Genera el índice de CRC de cada archivo para la carga útil de -s y termina [opcional].\n"
+            " -c --cc <reno|bbr>\t\t Control de congestión del servidor (default: reno) [opcional].\n"
+            " -F --fec <xor:K|rs:K:M>\t Envía M frames de paridad por cada K de datos; requiere -m sr [opcional].\n"
+            " -H --hugepages \t\t Reserva las ventanas del servidor en páginas enormes (2 MiB) [opcional].\n"
             " -h --help \t\t\t Muestra este mensaje de ayuda [opcional].\n"
             " -v --verbose \t\t\t Imprime mensajes detallados del funcionamiento del programa [opcional].\n");
 }
@@ -130,3 +220,370 @@ void get_argv(char **words, char *string)
     
     //words[windex] = NULL;
 }
+
+// convierte el nombre de un modo ("sw", "gbn", "sr") a su valor, -1 si no es válido
+ArqMode parse_mode(const char *string)
+{
+    if (strncmp(string, "gbn", 3) == 0)
+        return MODE_GBN;
+    if (strncmp(string, "sr", 2) == 0)
+        return MODE_SR;
+    if (strncmp(string, "sw", 2) == 0)
+        return MODE_SW;
+    return -1;
+}
+
+// nombre de un modo, tal como se anuncia en el handshake
+const char *mode_name(ArqMode mode)
+{
+    switch (mode)
+    {
+    case MODE_GBN:
+        return "gbn";
+    case MODE_SR:
+        return "sr";
+    default:
+        return "sw";
+    }
+}
+
+// busca "clave=valor" en un mensaje del handshake (p. ej. "200 mode=gbn window=8")
+// y regresa un apuntador al valor, o NULL si la clave no aparece.
+// Las palabras se separan con espacios o saltos de línea
+const char *handshake_value(const char *message, const char *key)
+{
+    const size_t key_len = strlen(key);
+
+    for (const char *word = message; *word != '\0'; word += strcspn(word, " \n"), word += *word != '\0')
+    {
+        if (strncmp(word, key, key_len) == 0 && word[key_len] == '=')
+        {
+            return word + key_len + 1;
+        }
+    }
+    return NULL;
+}
+
+// microsegundos transcurridos desde 'since' (reloj monotónico)
+long elapsed_us(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000000L + (now.tv_nsec - since->tv_nsec) / 1000;
+}
+
+// el reloj monotónico en microsegundos
+long monotonic_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+// escribe la cabecera de 'frame' en orden de red
+void frame_header_pack(const Frame *frame, FrameHeader *header)
+{
+    header->seqnum = htonl(frame->seqnum);
+    header->ack = htonl((uint32_t)frame->ack);
+    header->length = htons((uint16_t)frame->items);
+    header->flags = htons(frame->flags);
+    header->FCS = htonl(frame->FCS);
+}
+
+// CRC del frame: la carga útil seguida de la cabecera empaquetada (sin el campo FCS).
+// Empezar por la carga útil permite reutilizar su CRC para el CRC del archivo completo
+static uint32_t frame_checksum(const Frame *frame, uint32_t payload_crc)
+{
+    FrameHeader header;
+    frame_header_pack(frame, &header);
+    return crc32_update(offsetof(FrameHeader, FCS), payload_crc, (const unsigned char *)&header);
+}
+
+// calcula el FCS de 'frame' y regresa el CRC-32 de su carga útil sola
+uint32_t frame_seal(Frame *frame)
+{
+    const uint32_t payload_crc = crc32_update(frame->items, 0, (const unsigned char *)frame->packet.data);
+    frame->FCS = frame_checksum(frame, payload_crc);
+    return payload_crc;
+}
+
+// igual que frame_seal(), con el CRC-32 de la carga útil ya calculado
+void frame_seal_crc(Frame *frame, uint32_t payload_crc)
+{
+    frame->FCS = frame_checksum(frame, payload_crc);
+}
+
+// verifica el FCS de 'frame'; si es correcto deja en 'payload_crc' el CRC-32 de la carga útil
+bool frame_verify(const Frame *frame, uint32_t *payload_crc)
+{
+    *payload_crc = crc32_update(frame->items, 0, (const unsigned char *)frame->packet.data);
+    return frame_checksum(frame, *payload_crc) == frame->FCS;
+}
+
+// envía la cabecera compacta seguida de los bytes válidos del frame, sin copiarlos
+ssize_t frame_send(int sock_fd, const Frame *frame, const struct sockaddr_in *to)
+{
+    FrameHeader header;
+    frame_header_pack(frame, &header);
+    struct iovec iov[2] = {
+        {.iov_base = &header, .iov_len = sizeof header},
+        {.iov_base = (void *)frame->packet.data, .iov_len = frame->items}};
+    struct msghdr message = {
+        .msg_name = (void *)to,
+        .msg_namelen = sizeof *to,
+        .msg_iov = iov,
+        .msg_iovlen = 2};
+
+    return sendmsg(sock_fd, &message, 0);
+}
+
+// recibe un frame directamente en 'frame'; regresa -1 si el datagrama no es un frame válido
+ssize_t frame_recv(int sock_fd, Frame *frame, struct sockaddr_in *from)
+{
+    FrameHeader header;
+    struct iovec iov[2] = {
+        {.iov_base = &header, .iov_len = sizeof header},
+        {.iov_base = frame->packet.data, .iov_len = frame->packet.size}};
+    struct msghdr message = {
+        .msg_name = from,
+        .msg_namelen = sizeof *from,
+        .msg_iov = iov,
+        .msg_iovlen = 2};
+
+    const ssize_t bytes = recvmsg(sock_fd, &message, 0);
+    if (bytes < 0 || (message.msg_flags & MSG_TRUNC) || !frame_header_unpack(frame, &header, bytes))
+    {
+        return -1;
+    }
+    return bytes;
+}
+
+// envía 'count' frames al mismo destino con una sola llamada a sendmmsg.
+// Regresa cuántos se enviaron (si son menos que 'count', errno dice por qué) o -1 si ninguno.
+// Las cabeceras se empaquetan en cada frame y no en la pila, porque con MSG_ZEROCOPY
+// el kernel las lee después de regresar. Si el kernel no tiene sendmmsg se envían
+// uno por uno con frame_send()
+int frame_send_batch(int sock_fd, Frame *const *frames, size_t count, const struct sockaddr_in *to, int flags)
+{
+    struct iovec iov[frame_batch_max][2];
+    struct mmsghdr messages[frame_batch_max];
+    size_t sent = 0;
+
+    if (count > frame_batch_max)
+    {
+        count = frame_batch_max;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        frame_header_pack(frames[i], &frames[i]->wire);
+        iov[i][0] = (struct iovec){.iov_base = &frames[i]->wire, .iov_len = sizeof frames[i]->wire};
+        iov[i][1] = (struct iovec){.iov_base = frames[i]->packet.data, .iov_len = frames[i]->items};
+        messages[i] = (struct mmsghdr){.msg_hdr = {
+            .msg_name = (void *)to,
+            .msg_namelen = sizeof *to,
+            .msg_iov = iov[i],
+            .msg_iovlen = 2}};
+    }
+
+    // sendmmsg puede quedarse a medias; seguimos hasta que el kernel diga por qué se detuvo
+    while (sent < count)
+    {
+        const int result = sendmmsg(sock_fd, messages + sent, count - sent, flags);
+        if (result < 0 && errno == ENOSYS)
+        {
+            if (frame_send(sock_fd, frames[sent], to) < 0)
+            {
+                break;
+            }
+            sent++;
+        }
+        else if (result < 0)
+        {
+            break;
+        }
+        else
+        {
+            sent += (size_t)result;
+        }
+    }
+    return sent > 0 ? (int)sent : -1;
+}
+
+// cuántos de los primeros 'count' frames caben en un solo envío GSO: todos del mismo
+// tamaño en la red salvo el último, que puede ser más corto, y a lo más un datagrama máximo
+size_t frame_gso_count(Frame *const *frames, size_t count)
+{
+    const size_t segment = sizeof(FrameHeader) + frames[0]->items;
+    size_t total = 0;
+    size_t i = 0;
+
+    while (i < count && i < frame_batch_max && total + segment <= 65507)
+    {
+        const size_t length = sizeof(FrameHeader) + frames[i]->items;
+        if (length > segment)
+        {
+            break;
+        }
+        total += segment;
+        i++;
+        if (length < segment)
+        {
+            break;
+        }
+    }
+    return i;
+}
+
+// envía 'count' frames (ver frame_gso_count) como un solo datagrama que el kernel
+// o la tarjeta parten en segmentos del tamaño del primero (UDP_SEGMENT).
+// Regresa 'count' o -1; con EIO o EINVAL la ruta no soporta GSO
+int frame_send_gso(int sock_fd, Frame *const *frames, size_t count, const struct sockaddr_in *to, int flags)
+{
+    struct iovec iov[frame_batch_max * 2];
+    char control[CMSG_SPACE(sizeof(uint16_t))] = {0};
+    const uint16_t segment = (uint16_t)(sizeof(FrameHeader) + frames[0]->items);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        frame_header_pack(frames[i], &frames[i]->wire);
+        iov[2 * i] = (struct iovec){.iov_base = &frames[i]->wire, .iov_len = sizeof frames[i]->wire};
+        iov[2 * i + 1] = (struct iovec){.iov_base = frames[i]->packet.data, .iov_len = frames[i]->items};
+    }
+    struct msghdr message = {
+        .msg_name = (void *)to,
+        .msg_namelen = sizeof *to,
+        .msg_iov = iov,
+        .msg_iovlen = 2 * count,
+        .msg_control = control,
+        .msg_controllen = sizeof control};
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof segment);
+    memcpy(CMSG_DATA(cmsg), &segment, sizeof segment);
+
+    return sendmsg(sock_fd, &message, flags) < 0 ? -1 : (int)count;
+}
+
+// recibe hasta 'count' frames con una sola llamada a recvmmsg, bloqueándose sólo hasta
+// que llegue el primero. En 'lengths[i]' queda el tamaño del datagrama i, o -1 si no es un
+// frame válido. Regresa cuántos datagramas se leyeron, o -1 en error.
+// Si el kernel no tiene recvmmsg se recibe uno solo con frame_recv()
+int frame_recv_batch(int sock_fd, Frame *frames, ssize_t *lengths, size_t count, struct sockaddr_in *from)
+{
+    FrameHeader headers[frame_batch_max];
+    struct iovec iov[frame_batch_max][2];
+    struct mmsghdr messages[frame_batch_max];
+
+    if (count > frame_batch_max)
+    {
+        count = frame_batch_max;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        iov[i][0] = (struct iovec){.iov_base = &headers[i], .iov_len = sizeof headers[i]};
+        iov[i][1] = (struct iovec){.iov_base = frames[i].packet.data, .iov_len = frames[i].packet.size};
+        messages[i] = (struct mmsghdr){.msg_hdr = {
+            .msg_name = from,
+            .msg_namelen = sizeof *from,
+            .msg_iov = iov[i],
+            .msg_iovlen = 2}};
+    }
+
+    const int received = recvmmsg(sock_fd, messages, count, MSG_WAITFORONE, NULL);
+    if (received < 0 && errno == ENOSYS)
+    {
+        lengths[0] = frame_recv(sock_fd, &frames[0], from);
+        return 1;
+    }
+    for (int i = 0; i < received; i++)
+    {
+        const size_t bytes = messages[i].msg_len;
+        const bool valid = !(messages[i].msg_hdr.msg_flags & MSG_TRUNC) && frame_header_unpack(&frames[i], &headers[i], bytes);
+        lengths[i] = valid ? (ssize_t)bytes : -1;
+    }
+    return received;
+}
+
+// lee la cabecera de un datagrama de 'bytes' bytes; falla si el tamaño no coincide con ella
+bool frame_header_unpack(Frame *frame, const FrameHeader *header, size_t bytes)
+{
+    if (bytes < sizeof *header || (size_t)ntohs(header->length) != bytes - sizeof *header)
+    {
+        return false;
+    }
+
+    frame->seqnum = ntohl(header->seqnum);
+    frame->ack = (int32_t)ntohl(header->ack);
+    frame->items = ntohs(header->length);
+    frame->flags = ntohs(header->flags);
+    frame->FCS = ntohl(header->FCS);
+    return true;
+}
+
+// interpreta un datagrama ya recibido como frame; la carga útil apunta dentro de 'buffer'
+bool frame_decode(Frame *frame, char *buffer, size_t bytes)
+{
+    FrameHeader header;
+
+    if (bytes < sizeof header)
+    {
+        return false;
+    }
+    memcpy(&header, buffer, sizeof header);
+    if (!frame_header_unpack(frame, &header, bytes))
+    {
+        return false;
+    }
+
+    frame->packet.data = buffer + sizeof header;
+    frame->packet.size = frame->items;
+    return true;
+}
+
+// reserva un buffer de 'size' bytes para la carga útil
+bool packet_alloc(Packet *packet, size_t size)
+{
+    packet->data = malloc(size);
+    packet->size = packet->data != NULL ? size : 0;
+    return packet->data != NULL;
+}
+
+void packet_free(Packet *packet)
+{
+    free(packet->data);
+    packet->data = NULL;
+    packet->size = 0;
+}
+
+// carga útil más grande que cabe en un datagrama sin fragmentar, según el MTU
+// que el kernel conoce para la ruta hacia 'to'; 0 si no se pudo determinar
+size_t path_mtu_payload(const struct sockaddr_in *to)
+{
+    const int probe_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    const int discover = IP_PMTUDISC_DO;
+    int mtu = 0;
+    socklen_t mtu_len = sizeof mtu;
+
+    // IP_MTU sólo está disponible en un socket conectado
+    if (probe_fd < 0 ||
+        setsockopt(probe_fd, IPPROTO_IP, IP_MTU_DISCOVER, &discover, sizeof discover) < 0 ||
+        connect(probe_fd, (const struct sockaddr *)to, sizeof *to) < 0 ||
+        getsockopt(probe_fd, IPPROTO_IP, IP_MTU, &mtu, &mtu_len) < 0)
+    {
+        mtu = 0;
+    }
+    if (probe_fd >= 0)
+    {
+        close(probe_fd);
+    }
+
+    // Restamos las cabeceras IPv4 (20), UDP (8) y la del frame
+    if ((size_t)mtu <= 28 + sizeof(FrameHeader))
+    {
+        return 0;
+    }
+    const size_t payload = mtu - 28 - sizeof(FrameHeader);
+    return payload < size_max ? payload : size_max;
+}
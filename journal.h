@@ -0,0 +1,324 @@
+#ifndef __JOURNAL_H
+#define __JOURNAL_H
+
+// Bitácora de progreso de una descarga, junto al archivo destino ("<archivo>.journal").
+// Guarda un bit por cacho escrito y el CRC-32 de cada cacho, así que si el cliente
+// muere a la mitad la siguiente ejecución revisa lo que ya tiene y sólo pide lo que falta.
+// En disco: la cabecera (JournalHeader), el mapa de bits y luego los CRC.
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crc32.h"
+
+#define journal_magic "SWJOURNAL2"
+#define journal_sync_chunks 256    // cachos entre dos fdatasync()
+#define journal_sync_us 1000000L   // lo más que se espera entre dos fdatasync()
+
+// la versión del archivo en el servidor: su fecha de modificación
+typedef struct {
+    int64_t sec;
+    int64_t nsec;
+}
+FileVersion;
+
+typedef struct {
+    char magic[12];
+    uint64_t total;            // bytes del archivo completo
+    uint64_t payload_size;     // bytes de cada cacho (el último puede ser menor)
+    FileVersion version;       // la versión de la que son los cachos escritos
+}
+JournalHeader;
+
+// un rango contiguo de bytes del archivo
+typedef struct {
+    uint64_t offset;
+    uint64_t length;
+}
+Range;
+
+typedef struct {
+    int fd;
+    int data_fd;               // el archivo destino; se sincroniza junto con la bitácora
+    char path[1100];
+    uint64_t total;
+    size_t payload_size;
+    FileVersion version;
+    uint64_t chunks;
+    uint8_t *bitmap;
+    uint32_t *crcs;
+    pthread_mutex_t lock;      // los flujos paralelos marcan cachos al mismo tiempo
+    unsigned int dirty;        // cachos marcados desde el último fdatasync()
+    long synced_at_us;
+}
+Journal;
+
+// declaraciones de funciones
+bool journal_open(Journal *journal, const char *filename);
+bool journal_create(Journal *journal, const char *filename, uint64_t total, size_t payload_size, FileVersion version);
+void journal_attach(Journal *journal, int data_fd);
+uint64_t journal_verify(Journal *journal);
+void journal_mark(Journal *journal, uint64_t chunk, uint32_t crc);
+void journal_forget(Journal *journal, uint64_t first, uint64_t count);
+bool journal_missing(const Journal *journal, Range **ranges, size_t *count);
+void journal_close(Journal *journal, bool complete);
+
+static long journal_now_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+static off_t journal_bitmap_offset(void)
+{
+    return (off_t)sizeof(JournalHeader);
+}
+
+static off_t journal_crcs_offset(const Journal *journal)
+{
+    return journal_bitmap_offset() + (off_t)((journal->chunks + 7) / 8);
+}
+
+static bool journal_has(const Journal *journal, uint64_t chunk)
+{
+    return (journal->bitmap[chunk / 8] & (1u << (chunk % 8))) != 0;
+}
+
+// reserva el estado en memoria de una bitácora de 'total' bytes en cachos de 'payload_size'
+static bool journal_alloc(Journal *journal, const char *filename, uint64_t total, size_t payload_size)
+{
+    memset(journal, 0, sizeof *journal);
+    journal->fd = -1;
+    journal->data_fd = -1;
+    snprintf(journal->path, sizeof journal->path, "%s.journal", filename);
+    journal->total = total;
+    journal->payload_size = payload_size;
+    journal->chunks = payload_size > 0 ? (total + payload_size - 1) / payload_size : 0;
+    journal->bitmap = calloc(journal->chunks / 8 + 1, 1);
+    journal->crcs = calloc(journal->chunks + 1, sizeof *journal->crcs);
+    journal->synced_at_us = journal_now_us();
+    pthread_mutex_init(&journal->lock, NULL);
+    return journal->bitmap != NULL && journal->crcs != NULL;
+}
+
+static void journal_free(Journal *journal)
+{
+    if (journal->fd >= 0)
+    {
+        close(journal->fd);
+    }
+    free(journal->bitmap);
+    free(journal->crcs);
+    pthread_mutex_destroy(&journal->lock);
+    journal->fd = -1;
+    journal->bitmap = NULL;
+    journal->crcs = NULL;
+}
+
+// lee la bitácora de 'filename' si existe; regresa false si no hay o no es válida
+bool journal_open(Journal *journal, const char *filename)
+{
+    JournalHeader header;
+    char path[1100];
+    snprintf(path, sizeof path, "%s.journal", filename);
+
+    const int fd = open(path, O_RDWR);
+    if (fd < 0)
+    {
+        return false;
+    }
+    if (pread(fd, &header, sizeof header, 0) != (ssize_t)sizeof header || memcmp(header.magic, journal_magic, sizeof journal_magic) != 0 ||
+        header.payload_size == 0 || !journal_alloc(journal, filename, header.total, (size_t)header.payload_size))
+    {
+        close(fd);
+        return false;
+    }
+    journal->fd = fd;
+    journal->version = header.version;
+
+    const size_t bitmap_size = (journal->chunks + 7) / 8;
+    const size_t crcs_size = journal->chunks * sizeof *journal->crcs;
+    if (pread(fd, journal->bitmap, bitmap_size, journal_bitmap_offset()) != (ssize_t)bitmap_size ||
+        pread(fd, journal->crcs, crcs_size, journal_crcs_offset(journal)) != (ssize_t)crcs_size)
+    {
+        journal_free(journal);
+        return false;
+    }
+    return true;
+}
+
+// crea (o reemplaza) la bitácora de 'filename' sin ningún cacho escrito
+bool journal_create(Journal *journal, const char *filename, uint64_t total, size_t payload_size, FileVersion version)
+{
+    JournalHeader header = {{0}, total, payload_size, version};
+    memcpy(header.magic, journal_magic, sizeof journal_magic);
+
+    if (!journal_alloc(journal, filename, total, payload_size))
+    {
+        journal_free(journal);
+        return false;
+    }
+    journal->version = version;
+    journal->fd = open(journal->path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (journal->fd < 0 || pwrite(journal->fd, &header, sizeof header, 0) != (ssize_t)sizeof header ||
+        ftruncate(journal->fd, journal_crcs_offset(journal) + (off_t)(journal->chunks * sizeof *journal->crcs)) < 0 ||
+        fdatasync(journal->fd) < 0)
+    {
+        journal_free(journal);
+        unlink(journal->path);
+        return false;
+    }
+    return true;
+}
+
+// el archivo destino que describe la bitácora
+void journal_attach(Journal *journal, int data_fd)
+{
+    journal->data_fd = data_fd;
+}
+
+// Vuelve a leer cada cacho marcado y compara su CRC: la bitácora puede llegar al disco
+// antes que los datos, y lo que no coincida se olvida. Regresa los cachos válidos
+uint64_t journal_verify(Journal *journal)
+{
+    uint64_t valid = 0;
+    unsigned char *const buffer = malloc(journal->payload_size);
+    if (buffer == NULL)
+    {
+        journal_forget(journal, 0, journal->chunks);
+        return 0;
+    }
+
+    for (uint64_t chunk = 0; chunk < journal->chunks; chunk++)
+    {
+        if (!journal_has(journal, chunk))
+        {
+            continue;
+        }
+        const uint64_t position = chunk * journal->payload_size;
+        const size_t size = journal->total - position < journal->payload_size ? journal->total - position : journal->payload_size;
+        if (pread(journal->data_fd, buffer, size, (off_t)position) == (ssize_t)size && crc32_update((unsigned int)size, 0, buffer) == journal->crcs[chunk])
+        {
+            valid++;
+        }
+        else
+        {
+            journal_forget(journal, chunk, 1);
+        }
+    }
+    free(buffer);
+    return valid;
+}
+
+// Marca un cacho como escrito con su CRC. Cada tantos cachos (o tanto tiempo) se
+// sincronizan los datos y luego la bitácora
+void journal_mark(Journal *journal, uint64_t chunk, uint32_t crc)
+{
+    if (journal == NULL || chunk >= journal->chunks)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&journal->lock);
+    journal->crcs[chunk] = crc;
+    journal->bitmap[chunk / 8] |= (uint8_t)(1u << (chunk % 8));
+    if (pwrite(journal->fd, &journal->crcs[chunk], sizeof *journal->crcs, journal_crcs_offset(journal) + (off_t)(chunk * sizeof *journal->crcs)) < 0 ||
+        pwrite(journal->fd, &journal->bitmap[chunk / 8], 1, journal_bitmap_offset() + (off_t)(chunk / 8)) < 0)
+    {
+        printf("[-] No se pudo actualizar la bitácora \"%s\".\n", journal->path);
+    }
+
+    const long now_us = journal_now_us();
+    if (++journal->dirty >= journal_sync_chunks || now_us - journal->synced_at_us >= journal_sync_us)
+    {
+        fdatasync(journal->data_fd);
+        fdatasync(journal->fd);
+        journal->dirty = 0;
+        journal->synced_at_us = now_us;
+    }
+    pthread_mutex_unlock(&journal->lock);
+}
+
+// desmarca 'count' cachos desde 'first', p. ej. los de un rango cuyo CRC no coincidió
+void journal_forget(Journal *journal, uint64_t first, uint64_t count)
+{
+    if (journal == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&journal->lock);
+    for (uint64_t chunk = first; chunk < first + count && chunk < journal->chunks; chunk++)
+    {
+        journal->bitmap[chunk / 8] &= (uint8_t)~(1u << (chunk % 8));
+        pwrite(journal->fd, &journal->bitmap[chunk / 8], 1, journal_bitmap_offset() + (off_t)(chunk / 8));
+    }
+    pthread_mutex_unlock(&journal->lock);
+}
+
+// Junta los cachos que faltan en rangos contiguos de bytes; el arreglo se reserva aquí
+// y hay que liberarlo. Regresa false si no hubo memoria
+bool journal_missing(const Journal *journal, Range **ranges, size_t *count)
+{
+    size_t capacity = 0;
+    *ranges = NULL;
+    *count = 0;
+
+    for (uint64_t chunk = 0; chunk < journal->chunks; chunk++)
+    {
+        if (journal_has(journal, chunk))
+        {
+            continue;
+        }
+        const uint64_t position = chunk * journal->payload_size;
+        const uint64_t size = journal->total - position < journal->payload_size ? journal->total - position : journal->payload_size;
+        if (*count > 0 && (*ranges)[*count - 1].offset + (*ranges)[*count - 1].length == position)
+        {
+            (*ranges)[*count - 1].length += size;
+            continue;
+        }
+        if (*count == capacity)
+        {
+            capacity = capacity > 0 ? capacity * 2 : 16;
+            Range *const grown = realloc(*ranges, capacity * sizeof **ranges);
+            if (grown == NULL)
+            {
+                free(*ranges);
+                *ranges = NULL;
+                return false;
+            }
+            *ranges = grown;
+        }
+        (*ranges)[(*count)++] = (Range){position, size};
+    }
+    return true;
+}
+
+// Cierra la bitácora. Al completar la descarga ya no hace falta y se borra;
+// si no, se sincroniza para la siguiente ejecución
+void journal_close(Journal *journal, bool complete)
+{
+    if (complete)
+    {
+        unlink(journal->path);
+    }
+    else
+    {
+        if (journal->data_fd >= 0)
+        {
+            fdatasync(journal->data_fd);
+        }
+        fdatasync(journal->fd);
+    }
+    journal_free(journal);
+}
+
+#endif
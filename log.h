@@ -0,0 +1,216 @@
+#ifndef __LOG_H
+#define __LOG_H
+
+// Registro por niveles a través de un anillo en memoria. log_at() formatea la línea en un
+// lugar del anillo y regresa; un hilo aparte vacía el anillo cada log_flush_us con un solo
+// fwrite(). Con el anillo lleno la línea se descarta y se cuenta en vez de bloquear.
+// Los niveles arriba de LOG_COMPILE_LEVEL (p. ej. -DLOG_COMPILE_LEVEL=LOG_INFO) no se compilan.
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef enum {
+    LOG_ERROR,
+    LOG_WARN,
+    LOG_INFO,
+    LOG_DEBUG          // una línea por paquete
+}
+LogLevel;
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_DEBUG
+#endif
+
+#define log_ring_size 16384        // registros; potencia de dos
+#define log_text_size 120
+#define log_flush_us 2000
+#define log_batch_size (64 << 10)
+
+#define log_at(level, ...)                                            \
+    do                                                                \
+    {                                                                 \
+        if ((level) <= LOG_COMPILE_LEVEL && (level) <= log_level)     \
+        {                                                             \
+            log_write(__VA_ARGS__);                                   \
+        }                                                             \
+    } while (0)
+#define log_error(...) log_at(LOG_ERROR, __VA_ARGS__)
+#define log_warn(...) log_at(LOG_WARN, __VA_ARGS__)
+#define log_info(...) log_at(LOG_INFO, __VA_ARGS__)
+#define log_debug(...) log_at(LOG_DEBUG, __VA_ARGS__)
+
+typedef struct {
+    unsigned int sequence;     // posición + 1 una vez publicado
+    unsigned short length;
+    char text[log_text_size];
+} __attribute__((aligned(64)))
+LogRecord;
+
+LogLevel log_level = LOG_INFO;
+
+static LogRecord log_ring[log_ring_size];
+static unsigned int log_enqueue_pos;
+static unsigned int log_dequeue_pos;
+static unsigned long log_dropped;
+static bool log_running;
+static bool log_stopping;
+static FILE *log_stream;
+static pthread_t log_thread;
+static pthread_mutex_t log_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// declaraciones de funciones
+void log_write(const char *format, ...) __attribute__((format(printf, 1, 2)));
+int log_start(FILE *stream);
+void log_sync(void);
+void log_stop(void);
+
+// Cola acotada de varios productores (la de Vyukov): un productor toma un lugar con un
+// compare-and-swap sobre la posición y lo publica guardando su número de secuencia, así
+// que ningún hilo espera a otro. Antes de log_start() se escribe directo al stream
+void log_write(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    if (!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE))
+    {
+        vfprintf(log_stream != NULL ? log_stream : stdout, format, args);
+        va_end(args);
+        return;
+    }
+
+    LogRecord *record;
+    unsigned int pos = __atomic_load_n(&log_enqueue_pos, __ATOMIC_RELAXED);
+    while (true)
+    {
+        record = &log_ring[pos & (log_ring_size - 1)];
+        const int diff = (int)(__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&log_enqueue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            __atomic_add_fetch(&log_dropped, 1, __ATOMIC_RELAXED);
+            va_end(args);
+            return;
+        }
+        else
+        {
+            pos = __atomic_load_n(&log_enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    const int length = vsnprintf(record->text, sizeof record->text, format, args);
+    va_end(args);
+    record->length = (unsigned short)(length < 0 ? 0 : length < log_text_size ? length : log_text_size - 1);
+    __atomic_store_n(&record->sequence, pos + 1, __ATOMIC_RELEASE);
+}
+
+// escribe todos los registros publicados; regresa cuántos fueron
+static unsigned int log_drain(void)
+{
+    static char batch[log_batch_size];
+    unsigned int count = 0;
+    size_t used = 0;
+
+    pthread_mutex_lock(&log_drain_lock);
+    while (true)
+    {
+        LogRecord *const record = &log_ring[log_dequeue_pos & (log_ring_size - 1)];
+        if (__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) != log_dequeue_pos + 1)
+        {
+            break;
+        }
+        if (used + record->length > sizeof batch)
+        {
+            fwrite(batch, 1, used, log_stream);
+            used = 0;
+        }
+        memcpy(batch + used, record->text, record->length);
+        used += record->length;
+        __atomic_store_n(&record->sequence, log_dequeue_pos + log_ring_size, __ATOMIC_RELEASE);
+        log_dequeue_pos++;
+        count++;
+    }
+    const unsigned long dropped = __atomic_exchange_n(&log_dropped, 0, __ATOMIC_RELAXED);
+    if (used > 0)
+    {
+        fwrite(batch, 1, used, log_stream);
+    }
+    if (dropped > 0)
+    {
+        fprintf(log_stream, "[-] Registro lleno: %lu mensajes descartados.\n", dropped);
+    }
+    if (used > 0 || dropped > 0)
+    {
+        fflush(log_stream);
+    }
+    pthread_mutex_unlock(&log_drain_lock);
+    return count;
+}
+
+static void *log_main(void *arg)
+{
+    (void)arg;
+    const struct timespec pause = {0, log_flush_us * 1000L};
+    while (!__atomic_load_n(&log_stopping, __ATOMIC_ACQUIRE))
+    {
+        if (log_drain() == 0)
+        {
+            nanosleep(&pause, NULL);
+        }
+    }
+    log_drain();
+    return NULL;
+}
+
+// arranca el hilo que vacía el anillo; log_stop() corre al salir
+int log_start(FILE *stream)
+{
+    log_stream = stream;
+    for (unsigned int i = 0; i < log_ring_size; i++)
+    {
+        log_ring[i].sequence = i;
+    }
+    log_enqueue_pos = log_dequeue_pos = 0;
+    log_stopping = false;
+    if (pthread_create(&log_thread, NULL, log_main, NULL) != 0)
+    {
+        return -1;
+    }
+    __atomic_store_n(&log_running, true, __ATOMIC_RELEASE);
+    atexit(log_stop);
+    return 0;
+}
+
+// vacía el anillo desde quien llama, p. ej. antes de un resumen impreso con printf()
+void log_sync(void)
+{
+    if (__atomic_load_n(&log_running, __ATOMIC_ACQUIRE))
+    {
+        log_drain();
+    }
+}
+
+// las líneas registradas después de esto se escriben directo
+void log_stop(void)
+{
+    if (!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+    __atomic_store_n(&log_running, false, __ATOMIC_RELEASE);
+    __atomic_store_n(&log_stopping, true, __ATOMIC_RELEASE);
+    pthread_join(log_thread, NULL);
+}
+
+#endif
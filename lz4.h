@@ -0,0 +1,239 @@
+#ifndef __LZ4_H
+#define __LZ4_H
+
+// Compresión LZ4 de cada frame por separado, en el formato de bloque sin la cabecera ni
+// las sumas del formato de frame de LZ4 (el frame ya trae su CRC). Así un frame perdido o
+// desordenado nunca impide descomprimir otro. Un bloque es una serie de secuencias: token,
+// literales, distancia de 16 bits little endian y largo del match; la última sólo trae literales.
+
+#include <stdint.h>
+#include <string.h>
+
+#define lz4_min_match 4
+#define lz4_last_literals 5    // un bloque siempre termina con literales...
+#define lz4_match_limit 12     // ... y su último match empieza a esta distancia del final
+#define lz4_max_offset 65535
+#define lz4_hash_log 12
+#define lz4_max_input 65536
+
+// declaraciones de funciones
+unsigned int lz4_compress(const unsigned char *src, unsigned int nbytes, unsigned char *dst, unsigned int capacity);
+int lz4_decompress(const unsigned char *src, unsigned int nbytes, unsigned char *dst, unsigned int capacity);
+int lz4_selftest(void);
+
+static inline uint32_t lz4_read32(const unsigned char *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof value);
+    return value;
+}
+
+static inline unsigned int lz4_hash(uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - lz4_hash_log);
+}
+
+// un campo de largo de 4 bits seguido de bytes en 255 mientras siga
+static unsigned char *lz4_put_length(unsigned char *op, unsigned char *end, unsigned int length)
+{
+    for (length -= 15; length >= 255; length -= 255)
+    {
+        if (op >= end)
+        {
+            return NULL;
+        }
+        *op++ = 255;
+    }
+    if (op >= end)
+    {
+        return NULL;
+    }
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+static unsigned char *lz4_put_sequence(unsigned char *op, unsigned char *end, const unsigned char *literals,
+                                       unsigned int literal_length, unsigned int offset, unsigned int match_length)
+{
+    unsigned char *const token = op;
+    if (op >= end)
+    {
+        return NULL;
+    }
+    op++;
+    *token = (unsigned char)((literal_length < 15 ? literal_length : 15) << 4);
+    if (literal_length >= 15)
+    {
+        op = lz4_put_length(op, end, literal_length);
+    }
+    if (op == NULL || (unsigned int)(end - op) < literal_length)
+    {
+        return NULL;
+    }
+    memcpy(op, literals, literal_length);
+    op += literal_length;
+
+    // La última secuencia termina en sus literales
+    if (match_length == 0)
+    {
+        return op;
+    }
+    if (end - op < 2)
+    {
+        return NULL;
+    }
+    *op++ = (unsigned char)offset;
+    *op++ = (unsigned char)(offset >> 8);
+    match_length -= lz4_min_match;
+    *token |= (unsigned char)(match_length < 15 ? match_length : 15);
+    if (match_length >= 15)
+    {
+        op = lz4_put_length(op, end, match_length);
+    }
+    return op;
+}
+
+// El buscador voraz de una sola prueba del modo "fast" de referencia. La tabla guarda
+// posiciones de 16 bits, que alcanzan porque un frame no pasa de 64 KiB. Regresa 0 si
+// la salida no cabría en menos de 'capacity'; entonces el frame va sin comprimir
+unsigned int lz4_compress(const unsigned char *src, unsigned int nbytes, unsigned char *dst, unsigned int capacity)
+{
+    if (nbytes > lz4_max_input)
+    {
+        return 0;
+    }
+    uint16_t table[1 << lz4_hash_log];
+    memset(table, 0, sizeof table);
+
+    unsigned char *op = dst;
+    unsigned char *const end = dst + capacity;
+    unsigned int anchor = 0, ip = 0, misses = 0;
+    while (nbytes > lz4_match_limit && ip < nbytes - lz4_match_limit)
+    {
+        const uint32_t sequence = lz4_read32(src + ip);
+        const unsigned int h = lz4_hash(sequence);
+        const unsigned int ref = table[h];
+
+        table[h] = (uint16_t)ip;
+        if (ref >= ip || ip - ref > lz4_max_offset || lz4_read32(src + ref) != sequence)
+        {
+            // Los datos que no se comprimen se saltan cada vez más rápido
+            ip += 1 + (misses++ >> 5);
+            continue;
+        }
+        misses = 0;
+
+        unsigned int length = lz4_min_match;
+        while (ip + length < nbytes - lz4_last_literals && src[ref + length] == src[ip + length])
+        {
+            length++;
+        }
+        op = lz4_put_sequence(op, end, src + anchor, ip - anchor, ip - ref, length);
+        if (op == NULL)
+        {
+            return 0;
+        }
+        ip += length;
+        anchor = ip;
+    }
+
+    op = lz4_put_sequence(op, end, src + anchor, nbytes - anchor, 0, 0);
+    return op != NULL && op < end ? (unsigned int)(op - dst) : 0;
+}
+
+// lee el resto de un campo de largo de 4 bits; -1 si la entrada se acaba antes
+static long lz4_get_length(const unsigned char *src, unsigned int nbytes, unsigned int *ip, unsigned int length)
+{
+    if (length != 15)
+    {
+        return length;
+    }
+    unsigned char byte;
+    do
+    {
+        if (*ip >= nbytes)
+        {
+            return -1;
+        }
+        byte = src[(*ip)++];
+        length += byte;
+    } while (byte == 255);
+    return length;
+}
+
+// revisa cada largo y distancia contra ambos buffers: la entrada viene de la red
+int lz4_decompress(const unsigned char *src, unsigned int nbytes, unsigned char *dst, unsigned int capacity)
+{
+    unsigned int ip = 0, op = 0;
+    while (ip < nbytes)
+    {
+        const unsigned char token = src[ip++];
+        const long literal_length = lz4_get_length(src, nbytes, &ip, token >> 4);
+        if (literal_length < 0 || (unsigned long)literal_length > nbytes - ip || (unsigned long)literal_length > capacity - op)
+        {
+            return -1;
+        }
+        memcpy(dst + op, src + ip, (size_t)literal_length);
+        ip += (unsigned int)literal_length;
+        op += (unsigned int)literal_length;
+        if (ip == nbytes)
+        {
+            break;
+        }
+
+        if (nbytes - ip < 2)
+        {
+            return -1;
+        }
+        const unsigned int offset = src[ip] | (unsigned int)src[ip + 1] << 8;
+        ip += 2;
+        long match_length = lz4_get_length(src, nbytes, &ip, token & 15);
+        if (offset == 0 || offset > op || match_length < 0 ||
+            (unsigned long)match_length + lz4_min_match > capacity - op)
+        {
+            return -1;
+        }
+
+        // El match puede traslaparse con lo que copia: va byte por byte
+        for (match_length += lz4_min_match; match_length > 0; match_length--, op++)
+        {
+            dst[op] = dst[op - offset];
+        }
+    }
+    return (int)op;
+}
+
+// comprime y descomprime texto, rachas y ruido de varios tamaños
+int lz4_selftest(void)
+{
+    enum { size = 5000 };
+    static unsigned char src[size], packed[size], unpacked[size];
+    static const char words[] = "2026-10-16 GET /index.html 200 ";
+    unsigned int random = 1, failures = 0;
+
+    for (unsigned int kind = 0; kind < 3; kind++)
+    {
+        for (unsigned int i = 0; i < size; i++)
+        {
+            random = random * 1103515245 + 12345;
+            // el tipo 0 es un log con un byte que cambia en cada línea
+            src[i] = kind == 0 ? (i % 31 == 11 ? (unsigned char)('0' + (random >> 16) % 10) : (unsigned char)words[i % (sizeof words - 1)]) :
+                     kind == 1 ? (unsigned char)(i / 300) : (unsigned char)(random >> 16);
+        }
+        for (unsigned int n = 0; n <= size; n += n < 40 ? 1 : 997)
+        {
+            const unsigned int packed_size = lz4_compress(src, n, packed, n);
+
+            // El texto y las rachas deben encogerse; el ruido no debe crecer
+            if (packed_size == 0)
+            {
+                failures += kind != 2 && n > 100;
+                continue;
+            }
+            failures += lz4_decompress(packed, packed_size, unpacked, n) != (int)n || memcmp(src, unpacked, n) != 0;
+        }
+    }
+    return failures == 0 ? 0 : -1;
+}
+
+#endif
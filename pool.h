@@ -0,0 +1,156 @@
+#ifndef __POOL_H
+#define __POOL_H
+
+// Pools de lugares de un solo tamaño, para los buffers de los frames y el estado de las
+// ventanas. Los lugares se cortan de slabs mapeados con mmap() y los libres forman una
+// lista ligada dentro de ellos mismos, así que pool_get() y pool_put() no llaman a malloc().
+// Un pool pertenece a un hilo: otros pueden usar un lugar, pero sólo él los toma y suelta.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define pool_align 64              // una línea de caché
+#define pool_slab_size (256 << 10) // el slab más chico, en bytes
+#define pool_huge_size (2 << 20)   // una página enorme
+
+typedef struct PoolSlab {
+    struct PoolSlab *next;
+    size_t size;
+}
+PoolSlab;
+
+typedef struct {
+    size_t slot_size;
+    size_t max_slots;          // tope de lugares; 0 si no hay
+    bool huge;                 // slabs en páginas enormes
+    PoolSlab *slabs;
+    void *free_list;
+    size_t slots;              // cortados de los slabs
+    size_t used;
+    size_t peak;
+    unsigned long huge_slabs;  // slabs mapeados con MAP_HUGETLB
+}
+Pool;
+
+// declaraciones de funciones
+void pool_init(Pool *pool, size_t slot_size, size_t max_slots, bool huge);
+void *pool_get(Pool *pool);
+void pool_put(Pool *pool, void *slot);
+void pool_exit(Pool *pool);
+
+static inline size_t pool_round(size_t size, size_t align)
+{
+    return (size + align - 1) / align * align;
+}
+
+// Mapea un slab más y agrega sus lugares a la lista libre. La cabecera ocupa la primera
+// línea de caché para que todos los lugares queden alineados
+static bool pool_grow(Pool *pool)
+{
+    const size_t header = pool_round(sizeof(PoolSlab), pool_align);
+    size_t size = header + pool->slot_size;
+    size = size > pool_slab_size ? size : pool_slab_size;
+    size = pool_round(size, pool->huge ? pool_huge_size : (size_t)sysconf(_SC_PAGESIZE));
+
+    size_t count = (size - header) / pool->slot_size;
+    if (pool->max_slots > 0)
+    {
+        if (pool->slots >= pool->max_slots)
+        {
+            return false;
+        }
+        if (count > pool->max_slots - pool->slots)
+        {
+            count = pool->max_slots - pool->slots;
+        }
+    }
+
+    // Sin páginas enormes reservadas se usan páginas normales y se piden las transparentes
+    PoolSlab *slab = MAP_FAILED;
+    if (pool->huge)
+    {
+        slab = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        pool->huge_slabs += slab != MAP_FAILED;
+    }
+    if (slab == MAP_FAILED)
+    {
+        slab = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (slab == MAP_FAILED)
+        {
+            return false;
+        }
+        if (pool->huge)
+        {
+            madvise(slab, size, MADV_HUGEPAGE);
+        }
+    }
+    slab->next = pool->slabs;
+    slab->size = size;
+    pool->slabs = slab;
+
+    // La dirección más baja queda al principio de la lista libre
+    unsigned char *slot = (unsigned char *)slab + header + count * pool->slot_size;
+    for (size_t i = 0; i < count; i++)
+    {
+        slot -= pool->slot_size;
+        *(void **)slot = pool->free_list;
+        pool->free_list = slot;
+    }
+    pool->slots += count;
+    return true;
+}
+
+// deja el pool vacío; el primer pool_get() mapea el primer slab
+void pool_init(Pool *pool, size_t slot_size, size_t max_slots, bool huge)
+{
+    memset(pool, 0, sizeof *pool);
+    pool->slot_size = pool_round(slot_size > sizeof(void *) ? slot_size : sizeof(void *), pool_align);
+    pool->max_slots = max_slots;
+    pool->huge = huge;
+}
+
+// un lugar libre, alineado a línea de caché y sin limpiar; NULL si el pool llegó a su
+// tope o no hubo memoria
+void *pool_get(Pool *pool)
+{
+    if (pool->free_list == NULL && !pool_grow(pool))
+    {
+        return NULL;
+    }
+    void *const slot = pool->free_list;
+    pool->free_list = *(void **)slot;
+    pool->used++;
+    pool->peak = pool->used > pool->peak ? pool->used : pool->peak;
+    return slot;
+}
+
+void pool_put(Pool *pool, void *slot)
+{
+    if (slot == NULL)
+    {
+        return;
+    }
+    *(void **)slot = pool->free_list;
+    pool->free_list = slot;
+    pool->used--;
+}
+
+// devuelve todos los slabs al kernel; sólo aquí se libera memoria
+void pool_exit(Pool *pool)
+{
+    while (pool->slabs != NULL)
+    {
+        PoolSlab *const slab = pool->slabs;
+        pool->slabs = slab->next;
+        munmap(slab, slab->size);
+    }
+    pool->free_list = NULL;
+    pool->slots = 0;
+    pool->used = 0;
+}
+
+#endif
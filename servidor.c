@@ -1,21 +1,344 @@
 /** Servidor
 */
 
+#define _GNU_SOURCE
+
 #include <stdint.h>
 #include "helpers.h"
 
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include <arpa/inet.h>
+#include <linux/errqueue.h>
 #include <netinet/in.h>
 
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/time.h>
 
 #include "crc32.h"
+#include "cc.h"
+#include "crcindex.h"
+#include "fec.h"
+#include "log.h"
+#include "lz4.h"
+#include "pool.h"
+
+#define transfer_buckets 1024       // cubetas iniciales de la tabla de transferencias
+#define idle_timeout_us 30000000L   // se descarta una transferencia sin acks durante 30 s
+#define tick_min_us 1000L           // resolución mínima del temporizador de retransmisión
+#define tick_max_us 100000L
+#define rto_min_us 2000L            // cota inferior del tiempo de retransmisión (RFC 6298 usa 1 s; aquí hay LANs)
+#define rto_max_us 10000000L        // cota superior tras el backoff exponencial
+#define workers_max 256
+#define datagram_buffer_size 1024   // los acks y las solicitudes son mucho más chicos
+#define zerocopy_min_bytes 16384    // por debajo de esto copiar es más barato que fijar páginas
+#define zerocopy_max_frags 17       // páginas que caben en un datagrama zero-copy (MAX_SKB_FRAGS)
+#define wheel_slots 256             // ranuras de la rueda de pacing...
+#define wheel_tick_us 250L          // ... de 250 us cada una: 64 ms hacia adelante
+#define pacing_burst_us 1000L       // a lo más 1 ms de datos sale junto al ritmo de envío
+#define dupack_threshold 3          // acks duplicados que indican un frame perdido
+#define batch_magic "SWBATCH1"      // primera línea del índice de un lote
+#define batch_max_files 4096        // archivos de un lote...
+#define batch_max_entries 16384     // ... paths que recorre la búsqueda, contando directorios...
+#define batch_max_size (1UL << 30)  // ... y bytes de su contenido
+#define cache_default_mib 256       // tamaño de la caché de archivos
+#define cache_buckets 1024
+
+// Un archivo en la caché: mapeado completo, compartido por todas las transferencias que
+// lo envían, y con el CRC-32 de cada cacho (de 'chunk_size' bytes) conforme se calcula.
+// Se identifica por dispositivo, inodo, tamaño y fecha de modificación: si alguno cambia
+// la entrada deja de servir y se libera cuando la suelta su última transferencia
+typedef struct CacheEntry {
+    char path[1024];
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    char *map;
+    size_t chunk_size;
+    uint64_t *crcs;                 // (1 << 32) | CRC, o 0 si aún no se calcula
+    unsigned int refs;
+    bool stale;                     // ya no está en la tabla
+    struct CacheEntry *next_in_bucket;
+    struct CacheEntry *newer;       // lista LRU: de la más reciente a la más vieja
+    struct CacheEntry *older;
+}
+CacheEntry;
+
+// Caché de archivos compartida por todos los workers, acotada en bytes mapeados
+typedef struct {
+    pthread_mutex_t lock;
+    CacheEntry *buckets[cache_buckets];
+    CacheEntry *newest;
+    CacheEntry *oldest;
+    size_t bytes;
+    size_t limit;
+    size_t entries;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long invalidated;
+}
+FileCache;
+
+// Un cacho comprimido por adelantado. El compresor lo publica al escribir 'stamp'
+// (seqnum + 1); 'length' es 0 si no se pudo achicar y se envía tal cual
+typedef struct {
+    uint32_t stamp;
+    uint32_t length;
+    uint32_t crc;                   // CRC-32 del cacho sin comprimir
+}
+CompressedChunk;
+
+// Los archivos de un lote, en el orden en que se envían. Al aceptar el lote sólo se arma
+// el índice; el contenido se lee de cada archivo conforme se preparan sus cachos
+typedef struct {
+    char **paths;
+    size_t *sizes;
+    size_t *starts;                 // dónde empieza cada archivo dentro del lote
+    size_t count;
+    size_t capacity;
+    size_t content_size;
+    size_t visited;                 // paths que recorrió la búsqueda
+    bool too_large;                 // se pasó de batch_max_files, batch_max_entries o batch_max_size
+    char *index;
+    size_t index_size;
+}
+BatchList;
+
+// El archivo del lote que tiene abierto quien lo lee, para no abrirlo en cada cacho
+typedef struct {
+    int fd;
+    size_t file;
+}
+BatchCursor;
+
+// Estado de la descarga de un cliente. Vive en la tabla del servidor, indexada por la
+// dirección del cliente, desde el "200" hasta el ack final (o hasta que el cliente desaparece)
+typedef struct Transfer {
+    struct sockaddr_in client;
+    char filename[1024];
+    size_t payload_size;
+
+    // El rango pedido del archivo, mapeado en memoria: la carga útil de cada frame apunta
+    // directo a él, así que ni los envíos ni los reenvíos copian o vuelven a leer el archivo.
+    // El mapeo empieza en la página que contiene el rango (map_base)
+    char *map;
+    size_t map_size;
+    char *map_base;
+    size_t map_base_size;
+    size_t file_size;
+    CacheEntry *cached;             // la entrada de la caché que tiene el mapeo, o NULL
+    uint64_t *chunk_crcs;           // CRC de cada cacho del rango, si la caché los guarda
+    bool cache_hit;                 // el archivo ya estaba en la caché
+    CrcIndex crc_index;             // el índice de CRC del archivo, si había uno vigente
+    const uint32_t *index_crcs;     // su CRC de cada cacho del rango
+    uint32_t *index_build;          // CRC de cada cacho, para escribir el índice al terminar
+    struct stat file_stat;          // la versión del archivo que describe el índice
+    uint32_t file_crc_net;          // carga útil del último frame
+    size_t batch_files;             // archivos de un lote (0 si es un solo archivo)
+    BatchList *batch;               // el lote, o NULL si es un solo archivo
+    BatchCursor batch_cursor;       // lo que lee el worker...
+    BatchCursor compress_cursor;    // ... y lo que lee el compresor
+    unsigned char *batch_buffers;   // cargas útiles del compresor, de la ventana y de la paridad
+    bool failed;                    // no se pudo leer un cacho; se descarta en el siguiente tick
+
+    // Paridad FEC del último bloque enviado. Se envía copiando, así que el buffer
+    // se reutiliza para el siguiente bloque en cuanto regresa el envío
+    unsigned char *parity;
+    Frame *parity_frames;
+
+    // Frames en vuelo, indexados por seqnum % window_size, para poder reenviarlos
+    Frame *window;
+    bool *acked;
+    bool *resent;
+    struct timespec *sent_at;
+
+    // Estimación del RTT de esta conexión (RFC 6298). Sólo se muestrean frames que no se
+    // reenviaron (regla de Karn) y cada timeout duplica el RTO hasta la siguiente muestra
+    long srtt_us;
+    long rttvar_us;
+    long rto_us;
+    unsigned long rtt_samples;
+    unsigned int backoffs;
+
+    // Control de congestión: cuántos frames puede haber en vuelo y a qué ritmo salen.
+    // 'pace_at' es el instante (reloj monotónico) en que se puede volver a enviar
+    CcState cc;
+    long pace_at_us;
+    int32_t last_cumulative_ack;
+    unsigned int dupacks;
+    uint32_t recover;               // 'next' al detectar la última pérdida por acks duplicados
+    uint32_t sack_high;             // uno más que el mayor seqnum confirmado por SACK
+    bool rwnd_known;                // el cliente ya anunció su ventana...
+    uint32_t rwnd_edge;             // ... y no acepta frames desde este seqnum
+    uint32_t rwnd;                  // la última ventana anunciada, en frames
+    unsigned long rwnd_limited;     // envíos que detuvo la ventana del cliente
+
+    // 'base' es el frame más antiguo sin confirmar, 'next' el siguiente a enviar y
+    // 'filled' el siguiente a preparar (puede adelantarse a 'next' si el socket se llenó)
+    uint32_t base;
+    uint32_t next;
+    uint32_t filled;
+    bool last_read;
+
+    // CRC-32 de todo lo leído del archivo, acumulado cacho por cacho
+    uint32_t file_crc;
+
+    struct timespec last_ack;
+    bool pump_pending;              // tiene espacio en la ventana; se envía al terminar el lote de acks
+    int msg_counter;
+    int ack_counter;
+
+    struct Transfer *next_in_bucket;
+
+    // Espera en la rueda de pacing hasta 'pace_at'
+    bool in_wheel;
+    uint32_t wheel_slot;
+    struct Transfer *next_in_wheel;
+
+    // Cachos comprimidos con LZ4 por el hilo compresor, en un anillo de dos ventanas
+    // indexado por seqnum: lo que se comprime nunca pisa un frame que pueda reenviarse.
+    // 'compress_limit' (base + dos ventanas) se actualiza bajo el candado del compresor
+    unsigned char *compressed;
+    CompressedChunk *compressed_chunks;
+    uint32_t compress_next;         // siguiente seqnum a comprimir; sólo lo toca el compresor
+    uint32_t compress_limit;
+    struct Transfer *next_in_compressor;
+    unsigned long compressed_frames;
+    unsigned long long raw_bytes;   // bytes de los cachos enviados, antes y después de comprimir
+    unsigned long long wire_bytes;
+}
+Transfer;
+
+// Rueda de temporizadores para el pacing: cada ranura junta las transferencias que pueden
+// volver a enviar en ese tick, así que programar y disparar cuesta O(1) por transferencia
+typedef struct {
+    Transfer *slots[wheel_slots];
+    long current;                   // último tick procesado (en unidades de wheel_tick_us)
+    size_t count;
+}
+TimerWheel;
+
+// Hilo compresor de un worker: comprime por adelantado los cachos de sus transferencias,
+// así que el ciclo de envío nunca espera. Lo que no alcanzó a comprimirse sale sin comprimir
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;            // hay más cachos que comprimir, o hay que terminar
+    pthread_cond_t idle;            // soltó la transferencia que estaba comprimiendo
+    Transfer *transfers;
+    Transfer *active;               // la que se comprime ahora, fuera del candado
+    bool stop;
+}
+Compressor;
+
+// Contadores de un worker; sólo los escribe su propio hilo
+typedef struct {
+    unsigned long transfers;       // transferencias iniciadas
+    unsigned long completed;       // terminadas con el ack final
+    unsigned long dropped;         // descartadas porque el cliente dejó de responder
+    unsigned long frames_sent;
+    unsigned long frames_resent;
+    unsigned long timeouts;        // expiraciones del RTO (cada una duplica el RTO)
+    unsigned long fast_retransmits; // pérdidas detectadas por acks duplicados
+    unsigned long loss_events;     // pérdidas que vio el control de congestión
+    unsigned long paced;           // veces que una transferencia esperó su ritmo de envío
+    unsigned long rwnd_limited;    // veces que la ventana del cliente detuvo el envío
+    unsigned long parity_sent;     // frames de paridad FEC
+    unsigned long compressed_frames;
+    unsigned long long raw_bytes;  // bytes de los cachos enviados, antes y después de comprimir
+    unsigned long long wire_bytes;
+    unsigned long acks;
+    unsigned long send_calls;      // llamadas al kernel para enviar frames
+    unsigned long recv_calls;      // llamadas al kernel para recibir datagramas
+    unsigned long zerocopy_sends;  // envíos con MSG_ZEROCOPY confirmados por el kernel
+    unsigned long zerocopy_copied; // ... de los cuales el kernel terminó copiando
+    unsigned long long bytes_sent;
+}
+ServerStats;
+
+// Dónde empieza cada parte de una transferencia dentro de su lugar del pool, cada una
+// en su propia línea de caché. Al crearla se limpia todo lo anterior a 'parity'
+typedef struct {
+    size_t window;
+    size_t acked;
+    size_t resent;
+    size_t sent_at;
+    size_t parity_frames;
+    size_t parity;                  // m cargas útiles de paridad FEC
+    size_t size;
+    size_t compressed;              // en el lugar del anillo: después de los CompressedChunk
+    size_t compress_size;
+}
+TransferLayout;
+
+// Configuración y estado de un worker del servidor: un socket propio (SO_REUSEPORT)
+// atendido por un ciclo de epoll. El kernel reparte a los clientes entre los sockets
+typedef struct {
+    int sock_fd;
+    int epoll_fd;
+    int timer_fd;
+    int stop_fd;
+    int pacing_fd;
+    long timer_tick_us;             // periodo del temporizador; 0 si está desarmado
+    bool pacing_armed;
+    bool send_blocked;
+    bool gso;                       // el socket acepta UDP_SEGMENT
+    bool zerocopy;                  // enviar cargas grandes con MSG_ZEROCOPY
+
+    ArqMode mode;
+    uint32_t window_size;
+    size_t max_payload;
+    long initial_rto_us;            // RTO antes de la primera muestra de RTT
+    long shortest_rto_us;           // el menor RTO entre las transferencias, para el tick
+    double e_percent;
+    const CcOps *cc_ops;
+    FecCode fec;                    // FEC_NONE si no se envía paridad
+    bool compress;                  // comprimir los cachos con LZ4
+    Compressor compressor;
+    FileCache *cache;               // compartida entre workers; NULL si está desactivada
+    TimerWheel wheel;
+
+    // Cada transferencia vive en un lugar del pool del worker junto con su ventana
+    // (frames en vuelo, su estado y la paridad); si comprime, su anillo ocupa un lugar
+    // del otro pool. Los frames en vuelo apuntan al mapeo (o a los buffers de un lote),
+    // al anillo o a la paridad, así que reenviar no copia, y crear o terminar una transferencia no llama a malloc
+    bool huge_pages;
+    TransferLayout layout;
+    Pool transfer_pool;
+    Pool compress_pool;
+
+    Transfer **buckets;
+    size_t bucket_count;
+    size_t transfer_count;
+
+    // Buffers para leer un lote de datagramas con recvmmsg, y las transferencias
+    // cuyos acks del lote abrieron espacio en la ventana
+    char (*recv_buffers)[datagram_buffer_size];
+    Transfer *pending[frame_batch_max];
+    size_t pending_count;
+
+    int index;
+    int cpu;
+    ServerStats stats;
+}
+Server;
 
 /**
  * @brief Imprime el correcto uso.
@@ -41,31 +364,64 @@ static int bind_socket(const int port, struct sockaddr_in* const config) {
     config->sin_port = htons(port);
     config->sin_addr.s_addr = INADDR_ANY;
     // Create the socket and execute `bind()`.
-    // Throw away the return value of the call.
-    const int sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
-    bind(sock_fd, (struct sockaddr*)config, sizeof *config);
+    // The socket is nonblocking: it is only read or written when epoll says so.
+    // Every worker binds its own socket to the same port with SO_REUSEPORT.
+    const int reuse = 1;
+    const int sock_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (sock_fd < 0)
+    {
+        return -1;
+    }
+    if (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof reuse) < 0 ||
+        bind(sock_fd, (struct sockaddr*)config, sizeof *config) < 0)
+    {
+        close(sock_fd);
+        return -1;
+    }
     return sock_fd;
 }
 
 /**
- * @brief Obtiene un path de archido de parte del cliente.
- *        Se bloquea hasta que se otorgue un string.
+ * @brief Recibe un lote de datagramas cualquiera sin bloquearse: paths de archivo
+ *        de clientes nuevos o acknowledgements de transferencias en curso.
  * 
  * @param sock_fd El file descriptor del socket.
- * @param buffer El buffer a ser escrito.
- *                    Siempre será terminado en nul en éxito.
- * @param buffer_size La máxima capacidad del buffer en bytes.
- * @param client_config La configuración del cliente.
- * @return El número de bytes leídos y por lo tanto escritos en el buffer.
+ * @param buffers Los buffers a ser escritos, de 'datagram_buffer_size' bytes.
+ *                    Siempre serán terminados en nul en éxito.
+ * @param lengths Los bytes leídos en cada buffer.
+ * @param client_configs La configuración del cliente de cada datagrama.
+ * @param count La cantidad de buffers.
+ * @return El número de datagramas leídos, o -1 si no hay más datagramas o hubo error.
  */
-static ssize_t recv_file_path(const int sock_fd, char* const buffer, const size_t buffer_size, struct sockaddr_in* const client_config) {
-    socklen_t client_size = sizeof *client_config;
-    const ssize_t bytes_read = recvfrom(sock_fd, buffer, buffer_size, MSG_WAITALL, (struct sockaddr*)client_config, &client_size);
-    if (bytes_read >= 0)
+static int recv_datagrams(const int sock_fd, char (*const buffers)[datagram_buffer_size], size_t* const lengths, struct sockaddr_in* const client_configs, const size_t count) {
+    struct iovec iov[frame_batch_max];
+    struct mmsghdr messages[frame_batch_max];
+
+    for (size_t i = 0; i < count; i++)
+    {
+        iov[i] = (struct iovec){.iov_base = buffers[i], .iov_len = datagram_buffer_size - 1};
+        messages[i] = (struct mmsghdr){.msg_hdr = {
+            .msg_name = &client_configs[i],
+            .msg_namelen = sizeof client_configs[i],
+            .msg_iov = &iov[i],
+            .msg_iovlen = 1}};
+    }
+
+    int received = recvmmsg(sock_fd, messages, count, MSG_DONTWAIT, NULL);
+    if (received < 0 && errno == ENOSYS)
     {
-        buffer[bytes_read] = '\0';
+        // Sin recvmmsg leemos de uno en uno
+        socklen_t client_size = sizeof client_configs[0];
+        const ssize_t bytes_read = recvfrom(sock_fd, buffers[0], datagram_buffer_size - 1, 0, (struct sockaddr*)&client_configs[0], &client_size);
+        messages[0].msg_len = (unsigned int)bytes_read;
+        received = bytes_read < 0 ? -1 : 1;
     }
-    return bytes_read;
+    for (int i = 0; i < received; i++)
+    {
+        lengths[i] = messages[i].msg_len;
+        buffers[i][lengths[i]] = '\0';
+    }
+    return received;
 }
 
 /**
@@ -74,219 +430,2533 @@ static ssize_t recv_file_path(const int sock_fd, char* const buffer, const size_
  * @param sock_fd El dile descriptor del socket.
  * @param response La respuesta a ser enviada. Debe ser un string.
  * @param client_config La configuración del cliente al que debe ser enviada la respuesta.
+ * @return El número de bytes enviados, o -1 en error (EAGAIN si el socket está lleno).
  */
-static void send_response(const int sock_fd, const char* const response, const struct sockaddr_in* const client_config) {
-    sendto(sock_fd, response, strlen(response), 0, (const struct sockaddr*)client_config, sizeof *client_config);
-}
-
-/**
- * @brief Lee un cacho de archivo de un archivo especificado.
- * 
- * @param from El archivo del cuál se va a leer.
- * @param buffer El buffer al cuál se va a escribir.
- * @param bytes El tamaño del cacho en bytes.
- * @return La cantidad de bytes que se leyeron, es decir, el cacho.
- */
-static size_t read_file_chunk(FILE* const from, void* const buffer, const size_t bytes) {
-    return fread(buffer, sizeof(char), bytes, from);
+static ssize_t send_response(const int sock_fd, const char* const response, const struct sockaddr_in* const client_config) {
+    return sendto(sock_fd, response, strlen(response), 0, (const struct sockaddr*)client_config, sizeof *client_config);
 }
 
 /**
- * @brief Envía un cacho de archivo a un cliente especificado.
- * 
- * @param sock_fd El file descriptor del socket.
- * @param frame El frame a ser enviado.
- * @param client_config El cliente al que debería ser enviada la respuesta.
- * @return El número de bytes enviados, o -1 en error.
+ * @brief Cuenta las páginas de memoria que abarca un buffer.
  */
-static ssize_t send_file_chunk(const int sock_fd, const Frame* const frame, const struct sockaddr_in* const client_config) {
-    return sendto(sock_fd, frame, sizeof *frame, 0, (const struct sockaddr*)client_config, sizeof *client_config);
+static size_t page_span(const void* const buffer, const size_t bytes) {
+    const uintptr_t page = 4096;
+    const uintptr_t start = (uintptr_t)buffer;
+    return bytes == 0 ? 0 : (start + bytes - 1) / page - start / page + 1;
 }
 
 /**
- * @brief Obtiene un path de archivo del cliente.
- *        Se bloqueará hasta que se reciba una respuesta.
- * 
- * @param sock_fd El file descriptor del socket.
- * @param frame El frame en el que se escribirá.
- * @param client_config La configuración del cliente.
- * @return El número de bytes leídos y por lo tanto escritos en el buffer.
+ * @brief Limita un envío GSO zero-copy a los segmentos cuyas páginas (cabecera y
+ *        carga útil de cada uno) caben en un solo sk_buff.
  */
-static ssize_t recv_ack(const int sock_fd, Frame* const frame, struct sockaddr_in* const client_config) {
-    socklen_t client_size = sizeof *client_config;
-    return recvfrom(sock_fd, frame, sizeof *frame, MSG_WAITALL, (struct sockaddr*)client_config, &client_size);
+static size_t zerocopy_segments(Frame* const* const frames, const size_t count) {
+    size_t frags = 0;
+    size_t segments = 0;
+    while (segments < count)
+    {
+        const Frame* const frame = frames[segments];
+        frags += page_span(&frame->wire, sizeof frame->wire) + page_span(frame->packet.data, frame->items);
+        if (frags > zerocopy_max_frags)
+        {
+            break;
+        }
+        segments++;
+    }
+    return segments;
 }
 
 /**
- * @brief Envía los contenidos de un arvhico completo a un cliente.
+ * @brief Envía un lote de cachos de archivo a un cliente especificado.
+ *        Con GSO los frames de igual tamaño salen en una sola llamada que el kernel
+ *        parte en datagramas; si no, se usa sendmmsg (o un envío por frame).
+ *        Con -e algunos salen con el FCS alterado, al azar.
  * 
- * @param sock_fd El file descriptor del socket.
- * @param filename El nombre el archivo a enviar.
- *                     Se asume que existe, o el servidor fallará.
- * @param client_config La configuración del cliente.
+ * @param server El servidor. Se deja de usar GSO si la ruta no lo soporta.
+ * @param frames Los frames a ser enviados. Sólo viajan las cabeceras y los bytes válidos.
+ * @param count La cantidad de frames.
+ * @param client_config El cliente al que deberían ser enviados.
+ * @return El número de frames enviados. Si es menor que 'count', errno dice por qué
+ *         (EAGAIN si el socket está lleno).
  */
-//static void send_file(const int sock_fd, const char* const filename, struct sockaddr_in* const client_config, const int percent, const int time)
-//static void send_file(const int sock_fd, const char* const filename, struct sockaddr_in* const client_config, const int miliseconds, double e_percent)
-static void send_file(const int sock_fd, const char* const filename, struct sockaddr_in* const client_config, const int miliseconds, double e_percent)
-{
-    // Nada que hacer si no se puede abrir el archivo de origen
-    printf("[+] Sending file \"%s\".\n", filename);
-    FILE* const input_file = fopen(filename, "r");
-    if (input_file == NULL)
+static size_t send_file_chunks(Server* const server, Frame* const* const frames, const size_t count, const struct sockaddr_in* const client_config) {
+    // Simulación de errores (-e): el FCS alterado sólo viaja en este envío, el frame de la
+    // ventana queda intacto para su retransmisión
+    bool corrupted[frame_batch_max] = {false};
+    for (size_t i = 0; server->e_percent < 1 && i < count && i < frame_batch_max; i++)
     {
-        printf("Unable to open file %s to read\n", filename);
-        exit(EXIT_FAILURE);
+        if (coin_flip(server->e_percent) == 0)
+        {
+            log_debug("[-] Paquete corrupto. Seqnum %u\n", frames[i]->seqnum);
+            corrupted[i] = true;
+            frames[i]->FCS++;
+        }
     }
 
-    // Inicializar en cero ambos frames
-    Frame send_frame = {0};
-    Frame recv_frame = {0};
+    size_t sent = 0;
+    bool copy = !server->zerocopy;
+    while (sent < count)
+    {
+        size_t segments = server->gso ? frame_gso_count(frames + sent, count - sent) : 0;
+        if (!copy && segments > 1)
+        {
+            segments = zerocopy_segments(frames + sent, segments);
+        }
+        const size_t wanted = segments > 1 ? segments : count - sent;
 
-    // Establecer el timeout del socket, según el valor recibido
-    const struct timeval timeout = {0, miliseconds};
-    setsockopt(sock_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(struct timeval)); 
+        // MSG_ZEROCOPY sólo compensa si la llamada mueve suficientes bytes
+        size_t bytes = 0;
+        for (size_t i = sent; i < sent + wanted; i++)
+        {
+            bytes += frames[i]->items;
+        }
+        const int flags = !copy && bytes >= zerocopy_min_bytes ? MSG_ZEROCOPY : 0;
+        int result;
 
-    int msg_counter = 0;
-    int ack_counter = 0;
+        server->stats.send_calls++;
+        if (segments > 1)
+        {
+            result = frame_send_gso(server->sock_fd, frames + sent, segments, client_config, flags);
+            if (result < 0 && (errno == EIO || errno == EINVAL))
+            {
+                // La ruta no soporta GSO (p. ej. sin checksum offload); seguimos con sendmmsg
+                server->gso = false;
+                continue;
+            }
+        }
+        else
+        {
+            result = frame_send_batch(server->sock_fd, frames + sent, count - sent, client_config, flags);
+        }
 
-    // Leemos un cacho a la vez del archivo
-    while ((send_frame.items = read_file_chunk(input_file, send_frame.packet.data, buff_size)))
-    {
-        send_frame.FCS = crc32_buffer(buff_size, buff_size % 2, (const unsigned char*)send_frame.packet.data);
+        // Sin memoria para fijar más páginas (o demasiadas para un datagrama)
+        // se vuelve a intentar copiando
+        if (result < 0 && (errno == ENOBUFS || errno == EMSGSIZE) && flags != 0)
+        {
+            copy = true;
+            continue;
+        }
 
-/*        if (coin_flip(e_percent) == 0)
+        if (result < 0)
         {
-            printf("[-] Paquete corrupto.\n");
-            send_frame.FCS = crc32_buffer(buff_size, buff_size % 2, (const unsigned char*)send_frame.packet.data) + 1;
+            break;
         }
-        if (coin_flip(e_percent) == 0)
+        sent += (size_t)result;
+        if ((size_t)result < wanted)
         {
-            printf("[-] Paquete corrupto.\n");
-            send_frame.FCS = crc32_buffer(buff_size, buff_size % 2, (const unsigned char*)send_frame.packet.data) + 1;
+            break;
         }
-*/
+    }
+
+    for (size_t i = 0; i < count && i < frame_batch_max; i++)
+    {
+        frames[i]->FCS -= corrupted[i];
+    }
+    return sent;
+}
+
+/**
+ * @brief Calcula la cubeta de un cliente en la tabla de transferencias.
+ */
+static size_t client_hash(const struct sockaddr_in* const client, const size_t bucket_count) {
+    const uint64_t key = ((uint64_t)client->sin_addr.s_addr << 16) | client->sin_port;
+    return (size_t)((key * 0x9e3779b97f4a7c15ULL) >> 32) & (bucket_count - 1);
+}
 
-        // Enviamos el cacho al cliente
-        send_file_chunk(sock_fd, &send_frame, client_config);
-        printf("[+] Mensaje enviado. Seqnum %d, bytes: %zu\n", send_frame.seqnum, send_frame.items);
-        msg_counter++;
+static bool same_client(const struct sockaddr_in* const a, const struct sockaddr_in* const b) {
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
 
-        // Esperamos el acknowledgement
-        // Reenviamos el paquete cada vez que ocurra un timeout
-        while (recv_ack(sock_fd, &recv_frame, client_config) < 0)
+/**
+ * @brief Busca la transferencia en curso de un cliente.
+ * 
+ * @return La transferencia, o NULL si el cliente no tiene una.
+ */
+static Transfer* transfer_find(const Server* const server, const struct sockaddr_in* const client) {
+    for (Transfer* transfer = server->buckets[client_hash(client, server->bucket_count)]; transfer != NULL; transfer = transfer->next_in_bucket)
+    {
+        if (same_client(&transfer->client, client))
         {
-            fprintf(stderr, "[-] Tiempo agotado, reenviando paquete (%s).\n", strerror(errno));
-            send_file_chunk(sock_fd, &send_frame, client_config);
-            printf("[+] Mensaje re-enviado. Seqnum %d, bytes: %zu\n", send_frame.seqnum, send_frame.items);
-            msg_counter++;
+            return transfer;
         }
-        ack_counter++;
-
-        // Invertimos el seqnum del siguiente cacho
-        send_frame.seqnum = send_frame.seqnum ? 0 : 1;
+    }
+    return NULL;
+}
 
-        // Recibir un ack negativo significa que acabamos
-        if (recv_frame.ack == -1) 
+/**
+ * @brief Agrega una transferencia a la tabla, duplicando las cubetas cuando hay
+ *        más transferencias que cubetas.
+ */
+static void transfer_insert(Server* const server, Transfer* const transfer) {
+    if (server->transfer_count >= server->bucket_count)
+    {
+        const size_t bucket_count = server->bucket_count * 2;
+        Transfer** const buckets = calloc(bucket_count, sizeof *buckets);
+        if (buckets != NULL)
         {
-            printf("[+] Archivo \"%s\" enviado.\n", filename);
+            for (size_t i = 0; i < server->bucket_count; i++)
+            {
+                while (server->buckets[i] != NULL)
+                {
+                    Transfer* const moved = server->buckets[i];
+                    server->buckets[i] = moved->next_in_bucket;
+                    const size_t bucket = client_hash(&moved->client, bucket_count);
+                    moved->next_in_bucket = buckets[bucket];
+                    buckets[bucket] = moved;
+                }
+            }
+            free(server->buckets);
+            server->buckets = buckets;
+            server->bucket_count = bucket_count;
+        }
+    }
+
+    const size_t bucket = client_hash(&transfer->client, server->bucket_count);
+    transfer->next_in_bucket = server->buckets[bucket];
+    server->buckets[bucket] = transfer;
+    server->transfer_count++;
+}
+
+/**
+ * @brief Programa una transferencia en la rueda de pacing para el instante 'at_us'.
+ *        Lo que cae más allá del horizonte de la rueda se vuelve a programar al dispararse.
+ */
+static void wheel_schedule(Server* const server, Transfer* const transfer, const long at_us) {
+    TimerWheel* const wheel = &server->wheel;
+    long tick = at_us / wheel_tick_us;
+    if (tick <= wheel->current)
+    {
+        tick = wheel->current + 1;
+    }
+    else if (tick - wheel->current >= wheel_slots)
+    {
+        tick = wheel->current + wheel_slots - 1;
+    }
 
-            // Imprimimos información sobre el archivo obtenido
-            printf("[+] Obtención de archivo \"%s\" finalizada!\n", filename);
-            printf("Nombre del archivo: %s\n", filename);
-            printf("Tamaño del archivo: %zu bytes.\n", get_file_size(input_file));
-            printf("Tamaño del buffer: %d bytes.\n", buff_size);
-            printf("Total de mensajes enviados (DATA): %d.\n", msg_counter);
-            printf("Total de confirmaciones recibidas (ACK): %d.\n", ack_counter);
-            printf("[+] Listo...\n");
+    transfer->wheel_slot = (uint32_t)(tick % wheel_slots);
+    transfer->next_in_wheel = wheel->slots[transfer->wheel_slot];
+    wheel->slots[transfer->wheel_slot] = transfer;
+    transfer->in_wheel = true;
+    wheel->count++;
+}
 
+/**
+ * @brief Saca una transferencia de la rueda de pacing, si estaba en ella.
+ */
+static void wheel_cancel(Server* const server, Transfer* const transfer) {
+    if (!transfer->in_wheel)
+    {
+        return;
+    }
+    for (Transfer** link = &server->wheel.slots[transfer->wheel_slot]; *link != NULL; link = &(*link)->next_in_wheel)
+    {
+        if (*link == transfer)
+        {
+            *link = transfer->next_in_wheel;
+            server->wheel.count--;
             break;
         }
     }
-    fclose(input_file);
+    transfer->in_wheel = false;
 }
 
-int main(int argc, char **argv)
-{
-    // Revisamos el correcto funcionamiento
-/*    if (argc != 2) {
-        return print_usage();
+static size_t cache_hash(const char* const path) {
+    size_t hash = 5381;
+    for (const char* c = path; *c != '\0'; c++)
+    {
+        hash = hash * 33 + (unsigned char)*c;
     }
-*/
+    return hash % cache_buckets;
+}
 
-    // Configuramos y activamos el servidor
-    struct sockaddr_in server_config = {0};
-    const int port = 2020;
-    const int sock_fd = bind_socket(port, &server_config);
-    printf("SERVIDOR ACTIVO EN EL PUERTO %d\n", port);
+static void cache_free_entry(FileCache* const cache, CacheEntry* const entry) {
+    if (entry->map != NULL)
+    {
+        munmap(entry->map, (size_t)entry->size);
+    }
+    cache->bytes -= (size_t)entry->size;
+    cache->entries--;
+    free(entry->crcs);
+    free(entry);
+}
 
-    // Inicializamos en cero los campos del cliente
-    // El cliente se 'llena' abajo en el recvfrom()
-    struct sockaddr_in client_config = {0};
-    socklen_t client_len = sizeof(client_config);
+/**
+ * @brief Saca una entrada de la tabla y de la lista LRU. Se libera ya si nadie la usa;
+ *        si no, la libera cache_release() al soltarla la última transferencia.
+ */
+static void cache_unlink(FileCache* const cache, CacheEntry* const entry) {
+    for (CacheEntry** link = &cache->buckets[cache_hash(entry->path)]; *link != NULL; link = &(*link)->next_in_bucket)
+    {
+        if (*link == entry)
+        {
+            *link = entry->next_in_bucket;
+            break;
+        }
+    }
+    *(entry->newer != NULL ? &entry->newer->older : &cache->newest) = entry->older;
+    *(entry->older != NULL ? &entry->older->newer : &cache->oldest) = entry->newer;
+    entry->stale = true;
+    if (entry->refs == 0)
+    {
+        cache_free_entry(cache, entry);
+    }
+}
 
-    char *program_name = argv[0]; // almacenamos el nombre del programa
+// desaloja de la más vieja a la más nueva las entradas sin transferencias hasta caber
+static void cache_evict(FileCache* const cache) {
+    CacheEntry* entry = cache->oldest;
+    while (cache->bytes > cache->limit && entry != NULL)
+    {
+        CacheEntry* const newer = entry->newer;
+        if (entry->refs == 0)
+        {
+            cache_unlink(cache, entry);
+        }
+        entry = newer;
+    }
+}
 
-    int timeout_val = 0;
-    double e_percent = 1;
+static bool cache_same_file(const CacheEntry* const entry, const struct stat* const file_stat) {
+    return entry->dev == file_stat->st_dev && entry->ino == file_stat->st_ino && entry->size == file_stat->st_size &&
+           entry->mtime.tv_sec == file_stat->st_mtim.tv_sec && entry->mtime.tv_nsec == file_stat->st_mtim.tv_nsec;
+}
 
-    // obteniendo argumentos
-    while ((opt = getopt(argc, argv, short_options)) != -1)
+/**
+ * @brief Toma el archivo 'path' de la caché, mapeándolo si no estaba o si cambió en disco.
+ *        Un acierto no abre ni lee el archivo: sólo compara su stat() con el de la entrada.
+ *
+ * @param cache La caché.
+ * @param path El archivo.
+ * @param chunk_size La carga útil de la transferencia; la entrada guarda los CRC de
+ *        cachos de ese tamaño si es la primera en pedirla.
+ * @param hit Si la entrada ya estaba.
+ * @return La entrada, con una referencia más, o NULL si el archivo no existe, no es regular
+ *         o no cabe en la caché.
+ */
+static CacheEntry* cache_acquire(FileCache* const cache, const char* const path, const size_t chunk_size, bool* const hit) {
+    struct stat file_stat;
+    *hit = false;
+    if (strlen(path) >= sizeof ((CacheEntry*)NULL)->path || stat(path, &file_stat) < 0 || !S_ISREG(file_stat.st_mode) ||
+        (size_t)file_stat.st_size > cache->limit)
     {
-        switch(opt)
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    for (CacheEntry* entry = cache->buckets[cache_hash(path)]; entry != NULL; entry = entry->next_in_bucket)
+    {
+        if (strcmp(entry->path, path) != 0)
         {
-            case 't':
-                timeout_val = atoi(optarg);
-                continue;
-            case ':':
-                printf("Argumento %c no proporcionado\n", optopt);
-                usage(stdout, program_name);
-                exit(EXIT_FAILURE);
-            case 'h':
-                usage(stdout, program_name);
-                exit(EXIT_SUCCESS);
-            case 'e':
-                e_percent = strtod(optarg, NULL);
-                if (e_percent <= 0)
-                {
-                    e_percent = 1;
-                }
-                else if(e_percent > 100)
-                {
-                    printf("porcentaje no valido \n");
+            continue;
+        }
+        if (!cache_same_file(entry, &file_stat))
+        {
+            cache->invalidated++;
+            cache_unlink(cache, entry);
+            break;
+        }
 
-                }
-                else{
-                    e_percent = 1-(e_percent/100);
-                }
-                break;
-            default :
-                printf("Argumento desconocido: %c\n", optopt);
-                usage(stdout, program_name);
-                exit(EXIT_FAILURE);
+        // Pasa al frente de la lista LRU
+        *(entry->newer != NULL ? &entry->newer->older : &cache->newest) = entry->older;
+        *(entry->older != NULL ? &entry->older->newer : &cache->oldest) = entry->newer;
+        entry->older = cache->newest;
+        entry->newer = NULL;
+        *(cache->newest != NULL ? &cache->newest->newer : &cache->oldest) = entry;
+        cache->newest = entry;
+        entry->refs++;
+        cache->hits++;
+        *hit = true;
+        pthread_mutex_unlock(&cache->lock);
+        return entry;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    // Se mapea fuera del candado; la identidad se toma del archivo abierto
+    CacheEntry* const entry = calloc(1, sizeof *entry);
+    const int file_fd = open(path, O_RDONLY);
+    if (entry == NULL || file_fd < 0 || fstat(file_fd, &file_stat) < 0 || !S_ISREG(file_stat.st_mode) || (size_t)file_stat.st_size > cache->limit)
+    {
+        free(entry);
+        if (file_fd >= 0)
+        {
+            close(file_fd);
         }
+        return NULL;
+    }
+    snprintf(entry->path, sizeof entry->path, "%s", path);
+    entry->dev = file_stat.st_dev;
+    entry->ino = file_stat.st_ino;
+    entry->size = file_stat.st_size;
+    entry->mtime = file_stat.st_mtim;
+    entry->chunk_size = chunk_size;
+    entry->refs = 1;
+    entry->crcs = calloc(((size_t)file_stat.st_size + chunk_size - 1) / chunk_size + 1, sizeof *entry->crcs);
+    entry->map = file_stat.st_size > 0 ? mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_SHARED, file_fd, 0) : NULL;
+    close(file_fd);
+    if (entry->crcs == NULL || entry->map == MAP_FAILED)
+    {
+        free(entry->crcs);
+        free(entry);
+        return NULL;
     }
 
-    // Ciclo infinito, el servidor siempre debe estar "escuchando"
-    char buffer[1024];
-    while (1)
+    pthread_mutex_lock(&cache->lock);
+    const size_t bucket = cache_hash(path);
+    entry->next_in_bucket = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    entry->older = cache->newest;
+    *(cache->newest != NULL ? &cache->newest->newer : &cache->oldest) = entry;
+    cache->newest = entry;
+    cache->bytes += (size_t)entry->size;
+    cache->entries++;
+    cache->misses++;
+    cache_evict(cache);
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+}
+
+// libera la caché; ya no debe haber transferencias
+static void cache_destroy(FileCache* const cache) {
+    while (cache->oldest != NULL)
+    {
+        cache_unlink(cache, cache->oldest);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+// suelta una entrada tomada con cache_acquire()
+static void cache_release(FileCache* const cache, CacheEntry* const entry) {
+    pthread_mutex_lock(&cache->lock);
+    entry->refs--;
+    if (entry->stale && entry->refs == 0)
+    {
+        cache_free_entry(cache, entry);
+    }
+    else
+    {
+        cache_evict(cache);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+static void batch_free(BatchList* const list) {
+    for (size_t i = 0; i < list->count; i++)
     {
-        // Recibimos el camino del archivo a ser transferido
-        const int reply_len = recv_file_path(sock_fd, buffer, sizeof buffer, &client_config);
+        free(list->paths[i]);
+    }
+    free(list->paths);
+    free(list->sizes);
+    free(list->starts);
+    free(list->index);
+}
+
+/**
+ * @brief Lee 'size' bytes del lote desde 'offset': del índice, o de los archivos con
+ *        pread(). El cursor deja abierto el último archivo leído, así que los cachos
+ *        siguientes del mismo archivo no vuelven a abrirlo.
+ *
+ * @return false si un archivo ya no tiene los bytes que anunció el índice.
+ */
+static bool batch_read(const BatchList* const list, BatchCursor* const cursor, size_t offset, size_t size, unsigned char* buffer) {
+    while (size > 0)
+    {
+        if (offset < list->index_size)
+        {
+            const size_t part = size < list->index_size - offset ? size : list->index_size - offset;
+            memcpy(buffer, list->index + offset, part);
+            offset += part;
+            buffer += part;
+            size -= part;
+            continue;
+        }
 
-        // Seguimos escuchando si no se recibe un mensaje
-        if (reply_len > 0)
+        // El archivo que contiene 'offset' es el último que empieza antes o ahí mismo
+        size_t low = 0;
+        size_t high = list->count;
+        while (high - low > 1)
         {
-            if (check_file_exists(buffer))
+            const size_t middle = low + (high - low) / 2;
+            if (list->starts[middle] <= offset)
             {
-                send_response(sock_fd, "200", &client_config);
-                send_file(sock_fd, buffer, &client_config, timeout_val, e_percent);
+                low = middle;
             }
             else
             {
-                send_response(sock_fd, "404", &client_config);
+                high = middle;
             }
         }
+        if (cursor->fd < 0 || cursor->file != low)
+        {
+            if (cursor->fd >= 0)
+            {
+                close(cursor->fd);
+            }
+            cursor->fd = open(list->paths[low], O_RDONLY);
+            cursor->file = low;
+            if (cursor->fd < 0)
+            {
+                return false;
+            }
+        }
+
+        // Un archivo que se achicó desde que se midió deja el lote incompleto
+        const size_t end = list->starts[low] + list->sizes[low];
+        const size_t part = size < end - offset ? size : end - offset;
+        const ssize_t bytes = pread(cursor->fd, buffer, part, (off_t)(offset - list->starts[low]));
+        if (bytes <= 0)
+        {
+            return false;
+        }
+        offset += (size_t)bytes;
+        buffer += bytes;
+        size -= (size_t)bytes;
+    }
+    return true;
+}
+
+// A dónde regresa el hilo si leer un archivo mapeado provoca SIGBUS (alguien lo truncó
+// después de mapearlo); NULL fuera de las lecturas que lo esperan
+static __thread sigjmp_buf *mapping_fault;
+
+/**
+ * @brief Atiende el SIGBUS de un mapeo que se quedó sin archivo detrás: regresa al
+ *        sigsetjmp() de la lectura, que falla sólo su transferencia. Fuera de esas
+ *        lecturas es un error del programa y el proceso termina como siempre.
+ *
+ *        Se instala con SA_NODEFER, así que saltar fuera del manejador no deja la
+ *        señal bloqueada y sigsetjmp() no necesita guardar la máscara.
+ */
+static void mapping_fault_handler(const int signal_number) {
+    if (mapping_fault == NULL)
+    {
+        signal(signal_number, SIG_DFL);
+        return;
     }
-    close(sock_fd);
+    siglongjmp(*mapping_fault, 1);
+}
+
+/**
+ * @brief Los bytes del cacho 'seq' del rango: dentro del mapeo o, en un lote, leídos de
+ *        sus archivos a 'buffer'.
+ *
+ * @return NULL si no se pudieron leer.
+ */
+static const unsigned char* transfer_chunk(const Transfer* const transfer, BatchCursor* const cursor, const uint32_t seq, const size_t size,
+                                           unsigned char* const buffer) {
+    const size_t offset = (size_t)seq * transfer->payload_size;
+    if (transfer->batch == NULL)
+    {
+        return (const unsigned char*)transfer->map + offset;
+    }
+    return batch_read(transfer->batch, cursor, offset, size, buffer) ? buffer : NULL;
+}
+
+/**
+ * @brief CRC-32 de un cacho del rango: el del índice del archivo si hay uno vigente, el
+ *        que guardó la caché si ya se calculó (por esta u otra transferencia); si no, se
+ *        calcula y se guarda.
+ */
+static uint32_t transfer_chunk_crc(const Transfer* const transfer, const uint32_t seq, const unsigned char* const raw, const size_t size) {
+    if (transfer->index_crcs != NULL)
+    {
+        return transfer->index_crcs[seq];
+    }
+
+    uint64_t* const known = transfer->chunk_crcs != NULL ? &transfer->chunk_crcs[seq] : NULL;
+    const uint64_t value = known != NULL ? __atomic_load_n(known, __ATOMIC_RELAXED) : 0;
+    const uint32_t crc = value != 0 ? (uint32_t)value : crc32_update((unsigned int)size, 0, raw);
+    if (known != NULL && value == 0)
+    {
+        __atomic_store_n(known, (1ULL << 32) | crc, __ATOMIC_RELAXED);
+    }
+    if (transfer->index_build != NULL)
+    {
+        __atomic_store_n(&transfer->index_build[seq], crc, __ATOMIC_RELAXED);
+    }
+    return crc;
+}
+
+/**
+ * @brief Comprime los cachos de una transferencia hasta 'limit' (sin incluirlo). Corre en
+ *        el hilo compresor, sin el candado: el worker no toca esta parte del anillo.
+ */
+static void compress_chunks(Server* const server, Transfer* const transfer, const uint32_t limit) {
+    const uint32_t ring = 2 * server->window_size;
+
+    // Si el archivo se truncó, el cacho que provocó el SIGBUS queda sin comprimir y el
+    // worker descubre el error al leerlo él mismo
+    sigjmp_buf fault;
+    if (sigsetjmp(fault, 0) != 0)
+    {
+        CompressedChunk* const chunk = &transfer->compressed_chunks[transfer->compress_next % ring];
+        chunk->length = 0;
+        __atomic_store_n(&chunk->stamp, transfer->compress_next + 1, __ATOMIC_RELEASE);
+        transfer->compress_next++;
+    }
+    mapping_fault = &fault;
+
+    while (transfer->compress_next != limit)
+    {
+        const uint32_t seq = transfer->compress_next;
+        const size_t offset = (size_t)seq * transfer->payload_size;
+        const size_t size = transfer->map_size - offset < transfer->payload_size ? transfer->map_size - offset : transfer->payload_size;
+        const unsigned char* const raw = transfer_chunk(transfer, &transfer->compress_cursor, seq, size, transfer->batch_buffers);
+        CompressedChunk* const chunk = &transfer->compressed_chunks[seq % ring];
+
+        // Lo que no se pudo leer queda sin comprimir, y el worker descubre el error al leerlo
+        chunk->length = raw != NULL ? lz4_compress(raw, (unsigned int)size, transfer->compressed + (size_t)(seq % ring) * transfer->payload_size, (unsigned int)size) : 0;
+        if (raw != NULL)
+        {
+            chunk->crc = transfer_chunk_crc(transfer, seq, raw, size);
+        }
+        __atomic_store_n(&chunk->stamp, seq + 1, __ATOMIC_RELEASE);
+        transfer->compress_next = seq + 1;
+    }
+    mapping_fault = NULL;
+}
+
+/**
+ * @brief Hilo compresor: recorre las transferencias comprimiendo lo que les falta hasta
+ *        su límite, y duerme cuando ninguna tiene trabajo.
+ */
+static void* compressor_main(void* const arg) {
+    Server* const server = arg;
+    Compressor* const compressor = &server->compressor;
+
+    pthread_mutex_lock(&compressor->lock);
+    while (!compressor->stop)
+    {
+        bool progress = false;
+        for (Transfer* transfer = compressor->transfers; transfer != NULL && !compressor->stop; transfer = transfer->next_in_compressor)
+        {
+            const uint32_t limit = transfer->compress_limit;
+            if (limit == transfer->compress_next)
+            {
+                continue;
+            }
+            compressor->active = transfer;
+            pthread_mutex_unlock(&compressor->lock);
+            compress_chunks(server, transfer, limit);
+            pthread_mutex_lock(&compressor->lock);
+            compressor->active = NULL;
+            pthread_cond_broadcast(&compressor->idle);
+            progress = true;
+        }
+        if (!progress)
+        {
+            pthread_cond_wait(&compressor->wake, &compressor->lock);
+        }
+    }
+    pthread_mutex_unlock(&compressor->lock);
+    return NULL;
+}
+
+/**
+ * @brief Mueve el límite de compresión de una transferencia a dos ventanas adelante de
+ *        'base' y despierta al compresor si avanzó.
+ */
+static void compressor_kick(Server* const server, Transfer* const transfer) {
+    const uint64_t chunk_count = (transfer->map_size + transfer->payload_size - 1) / transfer->payload_size;
+    const uint64_t limit = (uint64_t)transfer->base + 2 * server->window_size;
+    const uint32_t target = (uint32_t)(limit < chunk_count ? limit : chunk_count);
+
+    if (transfer->compressed == NULL || target == transfer->compress_limit)
+    {
+        return;
+    }
+    pthread_mutex_lock(&server->compressor.lock);
+    transfer->compress_limit = target;
+    pthread_cond_signal(&server->compressor.wake);
+    pthread_mutex_unlock(&server->compressor.lock);
+}
+
+/**
+ * @brief Registra una transferencia ya mapeada con el compresor.
+ *
+ * @return false si el pool no tuvo lugar para el anillo; la transferencia sale sin comprimir.
+ */
+static bool compressor_add(Server* const server, Transfer* const transfer) {
+    unsigned char* const slot = pool_get(&server->compress_pool);
+    if (slot == NULL)
+    {
+        return false;
+    }
+    memset(slot, 0, server->layout.compressed);
+    transfer->compressed_chunks = (CompressedChunk*)slot;
+    transfer->compressed = slot + server->layout.compressed;
+
+    pthread_mutex_lock(&server->compressor.lock);
+    transfer->next_in_compressor = server->compressor.transfers;
+    server->compressor.transfers = transfer;
+    pthread_mutex_unlock(&server->compressor.lock);
+    compressor_kick(server, transfer);
+    return true;
+}
+
+/**
+ * @brief Saca una transferencia del compresor, esperando si la está comprimiendo.
+ */
+static void compressor_remove(Server* const server, Transfer* const transfer) {
+    if (transfer->compressed == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&server->compressor.lock);
+    for (Transfer** link = &server->compressor.transfers; *link != NULL; link = &(*link)->next_in_compressor)
+    {
+        if (*link == transfer)
+        {
+            *link = transfer->next_in_compressor;
+            break;
+        }
+    }
+    while (server->compressor.active == transfer)
+    {
+        pthread_cond_wait(&server->compressor.idle, &server->compressor.lock);
+    }
+    pthread_mutex_unlock(&server->compressor.lock);
+}
+
+/**
+ * @brief Saca una transferencia de la tabla y libera sus recursos.
+ */
+static void transfer_destroy(Server* const server, Transfer* const transfer) {
+    for (Transfer** link = &server->buckets[client_hash(&transfer->client, server->bucket_count)]; *link != NULL; link = &(*link)->next_in_bucket)
+    {
+        if (*link == transfer)
+        {
+            *link = transfer->next_in_bucket;
+            server->transfer_count--;
+            break;
+        }
+    }
+    for (size_t i = 0; transfer->pump_pending && i < server->pending_count; i++)
+    {
+        if (server->pending[i] == transfer)
+        {
+            server->pending[i] = server->pending[--server->pending_count];
+            break;
+        }
+    }
+    wheel_cancel(server, transfer);
+    compressor_remove(server, transfer);
+
+    pool_put(&server->compress_pool, transfer->compressed_chunks);
+    if (transfer->batch != NULL)
+    {
+        if (transfer->batch_cursor.fd >= 0)
+        {
+            close(transfer->batch_cursor.fd);
+        }
+        if (transfer->compress_cursor.fd >= 0)
+        {
+            close(transfer->compress_cursor.fd);
+        }
+        batch_free(transfer->batch);
+        free(transfer->batch);
+    }
+    free(transfer->index_build);
+    crc_index_close(&transfer->crc_index);
+    if (transfer->cached != NULL)
+    {
+        cache_release(server->cache, transfer->cached);
+    }
+    else if (transfer->map_base != NULL)
+    {
+        munmap(transfer->map_base, transfer->map_base_size);
+    }
+    pool_put(&server->transfer_pool, transfer);
+}
+
+/**
+ * @brief Crea el estado de una transferencia nueva; lo que se envía se mapea después
+ *        con transfer_map_file() o transfer_map_batch().
+ * 
+ * @param server El servidor.
+ * @param client El cliente que pidió el archivo.
+ * @param filename El nombre del archivo (o el patrón de un lote).
+ * @param payload_size La carga útil negociada con el cliente, en bytes.
+ * @return La transferencia, o NULL si el pool no tuvo lugar para ella.
+ */
+static Transfer* transfer_create(Server* const server, const struct sockaddr_in* const client, const char* const filename, const size_t payload_size) {
+    unsigned char* const slot = pool_get(&server->transfer_pool);
+    if (slot == NULL)
+    {
+        return NULL;
+    }
+    memset(slot, 0, server->layout.parity);
+
+    Transfer* const transfer = (Transfer*)slot;
+    transfer->client = *client;
+    snprintf(transfer->filename, sizeof transfer->filename, "%s", filename);
+    transfer->payload_size = payload_size;
+    transfer->window = (Frame*)(slot + server->layout.window);
+    transfer->acked = (bool*)(slot + server->layout.acked);
+    transfer->resent = (bool*)(slot + server->layout.resent);
+    transfer->sent_at = (struct timespec*)(slot + server->layout.sent_at);
+    if (server->fec.scheme != FEC_NONE)
+    {
+        transfer->parity = slot + server->layout.parity;
+        transfer->parity_frames = (Frame*)(slot + server->layout.parity_frames);
+    }
+    transfer->rto_us = server->initial_rto_us;
+    cc_init(&transfer->cc, server->cc_ops, payload_size + sizeof(FrameHeader), server->window_size);
+    if (transfer->rto_us < server->shortest_rto_us)
+    {
+        server->shortest_rto_us = transfer->rto_us;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &transfer->last_ack);
+
+    // Se inserta antes de mapear el archivo para que transfer_destroy() pueda limpiar todo
+    transfer_insert(server, transfer);
+    return transfer;
+}
+
+/**
+ * @brief Busca el índice de CRC del archivo para la carga útil de la transferencia. Si no
+ *        hay uno vigente y se envía el archivo completo, se juntan los CRC para escribirlo
+ *        al terminar, y los siguientes envíos ya no los calculan.
+ *
+ * @param transfer La transferencia, con el rango ya mapeado y 'file_stat' lleno.
+ * @param offset El inicio del rango.
+ */
+static void transfer_attach_index(Transfer* const transfer, const size_t offset) {
+    // El CRC del índice es el de un cacho completo: el último cacho del rango tiene que
+    // serlo también, o ser el final del archivo
+    if (transfer->file_size < crc_index_min_size || offset % transfer->payload_size != 0 ||
+        (transfer->map_size % transfer->payload_size != 0 && offset + transfer->map_size != transfer->file_size))
+    {
+        return;
+    }
+    if (crc_index_open(&transfer->crc_index, transfer->filename, transfer->payload_size, &transfer->file_stat))
+    {
+        transfer->index_crcs = transfer->crc_index.crcs + offset / transfer->payload_size;
+    }
+    else if (offset == 0 && transfer->map_size == transfer->file_size)
+    {
+        transfer->index_build = calloc((transfer->file_size + transfer->payload_size - 1) / transfer->payload_size, sizeof *transfer->index_build);
+    }
+}
+
+/**
+ * @brief Mapea el rango del archivo que se va a enviar.
+ *
+ *        Si la caché está activa y el archivo cabe, el rango apunta al mapeo compartido.
+ *
+ * @param server El servidor.
+ * @param transfer La transferencia.
+ * @param filename El nombre del archivo.
+ * @param offset El inicio del rango a enviar. Más allá del final queda un rango vacío.
+ * @param length El largo del rango; se recorta al final del archivo.
+ * @return false si no se pudo abrir o mapear el archivo.
+ */
+static bool transfer_map_file(Server* const server, Transfer* const transfer, const char* const filename, size_t offset, size_t length) {
+    bool hit = false;
+    CacheEntry* const entry = server->cache != NULL ? cache_acquire(server->cache, filename, transfer->payload_size, &hit) : NULL;
+    if (entry != NULL)
+    {
+        transfer->cached = entry;
+        transfer->file_size = (size_t)entry->size;
+        offset = offset < transfer->file_size ? offset : transfer->file_size;
+        length = length < transfer->file_size - offset ? length : transfer->file_size - offset;
+        transfer->map = entry->map != NULL ? entry->map + offset : NULL;
+        transfer->map_size = length;
+
+        // Los CRC guardados sólo sirven si los cachos caen en los mismos límites: el rango
+        // empieza en un cacho y su último cacho es completo o es el final del archivo
+        if (entry->chunk_size == transfer->payload_size && offset % transfer->payload_size == 0 &&
+            (length % transfer->payload_size == 0 || offset + length == transfer->file_size))
+        {
+            transfer->chunk_crcs = entry->crcs + offset / transfer->payload_size;
+        }
+        if (!hit && entry->map != NULL)
+        {
+            madvise(entry->map, (size_t)entry->size, MADV_SEQUENTIAL);
+        }
+        transfer->cache_hit = hit;
+        transfer->file_stat.st_size = entry->size;
+        transfer->file_stat.st_ino = entry->ino;
+        transfer->file_stat.st_mtim = entry->mtime;
+        transfer_attach_index(transfer, offset);
+        return true;
+    }
+
+    // Un rango vacío no se mapea: sólo se envía el último frame
+    struct stat file_stat;
+    const int file_fd = open(filename, O_RDONLY);
+    if (file_fd < 0 || fstat(file_fd, &file_stat) < 0 || !S_ISREG(file_stat.st_mode))
+    {
+        if (file_fd >= 0)
+        {
+            close(file_fd);
+        }
+        return false;
+    }
+    transfer->file_size = (size_t)file_stat.st_size;
+    offset = offset < transfer->file_size ? offset : transfer->file_size;
+    length = length < transfer->file_size - offset ? length : transfer->file_size - offset;
+    if (length > 0)
+    {
+        // mmap() sólo acepta posiciones alineadas a página
+        const size_t map_offset = offset & ~((size_t)sysconf(_SC_PAGESIZE) - 1);
+        void* const map = mmap(NULL, offset - map_offset + length, PROT_READ, MAP_SHARED, file_fd, (off_t)map_offset);
+        if (map == MAP_FAILED)
+        {
+            close(file_fd);
+            return false;
+        }
+        transfer->map_base = map;
+        transfer->map_base_size = offset - map_offset + length;
+        transfer->map = transfer->map_base + (offset - map_offset);
+        transfer->map_size = length;
+        madvise(transfer->map_base, transfer->map_base_size, MADV_SEQUENTIAL);
+    }
+    close(file_fd);
+    transfer->file_stat = file_stat;
+    transfer_attach_index(transfer, offset);
+    return true;
+}
+
+static bool batch_add(BatchList* const list, const char* const path, const size_t size) {
+    if (list->count == batch_max_files || size > batch_max_size - list->content_size)
+    {
+        list->too_large = true;
+        return false;
+    }
+    if (list->count == list->capacity)
+    {
+        const size_t capacity = list->capacity > 0 ? list->capacity * 2 : 64;
+        char** const paths = realloc(list->paths, capacity * sizeof *paths);
+        if (paths == NULL)
+        {
+            return false;
+        }
+        list->paths = paths;
+        size_t* const sizes = realloc(list->sizes, capacity * sizeof *sizes);
+        if (sizes == NULL)
+        {
+            return false;
+        }
+        list->sizes = sizes;
+        list->capacity = capacity;
+    }
+    list->paths[list->count] = strdup(path);
+    if (list->paths[list->count] == NULL)
+    {
+        return false;
+    }
+    list->sizes[list->count++] = size;
+    list->content_size += size;
+    return true;
+}
+
+/**
+ * @brief Agrega al lote un archivo regular, o todos los de un directorio (en orden
+ *        alfabético y recorriendo subdirectorios). Lo demás se ignora, igual que los
+ *        nombres con saltos de línea, que no caben en el índice.
+ *
+ * @return false si no hubo memoria o el lote se pasó de sus límites.
+ */
+static bool batch_collect(BatchList* const list, const char* const path) {
+    if (++list->visited > batch_max_entries)
+    {
+        list->too_large = true;
+        return false;
+    }
+    struct stat path_stat;
+    if (strchr(path, '\n') != NULL || stat(path, &path_stat) < 0)
+    {
+        return true;
+    }
+    if (S_ISREG(path_stat.st_mode))
+    {
+        return batch_add(list, path, (size_t)path_stat.st_size);
+    }
+    if (!S_ISDIR(path_stat.st_mode))
+    {
+        return true;
+    }
+
+    struct dirent** entries;
+    const int count = scandir(path, &entries, NULL, alphasort);
+    bool ok = true;
+    for (int i = 0; i < count; i++)
+    {
+        char child[PATH_MAX];
+        if (ok && strcmp(entries[i]->d_name, ".") != 0 && strcmp(entries[i]->d_name, "..") != 0 &&
+            snprintf(child, sizeof child, "%s/%s", path, entries[i]->d_name) < (int)sizeof child)
+        {
+            ok = batch_collect(list, child);
+        }
+        free(entries[i]);
+    }
+    if (count >= 0)
+    {
+        free(entries);
+    }
+    return ok;
+}
+
+/**
+ * @brief Arma el índice de texto del lote ("SWBATCH1 <archivos>" y luego "<bytes> <path>"
+ *        por archivo) y la posición de cada archivo detrás de él.
+ *
+ * @return false si no hubo memoria.
+ */
+static bool batch_build_index(BatchList* const list) {
+    list->starts = malloc(list->count * sizeof *list->starts);
+    list->index_size = (size_t)snprintf(NULL, 0, "%s %zu\n", batch_magic, list->count);
+    for (size_t i = 0; i < list->count; i++)
+    {
+        list->index_size += (size_t)snprintf(NULL, 0, "%zu %s\n", list->sizes[i], list->paths[i]);
+    }
+    list->index = malloc(list->index_size + 1);
+    if (list->starts == NULL || list->index == NULL)
+    {
+        return false;
+    }
+
+    size_t position = (size_t)sprintf(list->index, "%s %zu\n", batch_magic, list->count);
+    size_t start = list->index_size;
+    for (size_t i = 0; i < list->count; i++)
+    {
+        position += (size_t)sprintf(list->index + position, "%zu %s\n", list->sizes[i], list->paths[i]);
+        list->starts[i] = start;
+        start += list->sizes[i];
+    }
+    return true;
+}
+
+/**
+ * @brief Arma un lote con los archivos que coinciden con un patrón (glob, con {a,b}
+ *        para listar varios) o que están dentro de un directorio, y lo envía como si
+ *        fuera un solo archivo: primero el índice y enseguida el contenido de cada uno,
+ *        sin relleno. Así los archivos chicos comparten datagramas y todo el lote usa
+ *        una sola ventana y un solo handshake.
+ *
+ *        Aquí sólo se recorren los paths y se arma el índice; el contenido lo lee
+ *        transfer_fill() cacho por cacho, a un buffer por lugar de la ventana. La
+ *        búsqueda corre en el worker, así que el lote se acota en archivos y en bytes.
+ *
+ * @param server El servidor.
+ * @param transfer La transferencia.
+ * @param pattern El patrón de los archivos.
+ * @return false si nada coincide, el lote es demasiado grande o no hubo memoria.
+ */
+static bool transfer_map_batch(Server* const server, Transfer* const transfer, const char* const pattern) {
+    BatchList* const list = calloc(1, sizeof *list);
+    if (list == NULL)
+    {
+        return false;
+    }
+    transfer->batch_cursor.fd = transfer->compress_cursor.fd = -1;
+    transfer->batch = list;
+
+    glob_t matches;
+    bool ok = glob(pattern, GLOB_BRACE | GLOB_TILDE, NULL, &matches) == 0;
+    for (size_t i = 0; ok && i < matches.gl_pathc; i++)
+    {
+        ok = batch_collect(list, matches.gl_pathv[i]);
+    }
+    if (ok || matches.gl_pathc > 0)
+    {
+        globfree(&matches);
+    }
+    if (list->too_large)
+    {
+        log_warn("[-] El lote \"%s\" pasa de %d archivos o de %lu MiB.\n", pattern, batch_max_files, batch_max_size >> 20);
+    }
+    if (!ok || list->count == 0 || !batch_build_index(list))
+    {
+        return false;
+    }
+
+    // Un buffer para el compresor, uno por lugar de la ventana y uno por cacho de un bloque FEC
+    const size_t parity_chunks = server->fec.scheme != FEC_NONE ? server->fec.k : 0;
+    const size_t buffers_size = (1 + server->window_size + parity_chunks) * transfer->payload_size;
+    unsigned char* const buffers = mmap(NULL, buffers_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED)
+    {
+        return false;
+    }
+    transfer->batch_buffers = buffers;
+    transfer->map_base = (char*)buffers;
+    transfer->map_base_size = buffers_size;
+    transfer->map_size = transfer->file_size = list->index_size + list->content_size;
+    transfer->batch_files = list->count;
+    return true;
+}
+
+/**
+ * @brief Prepara el siguiente cacho del archivo en su lugar de la ventana, apuntando
+ *        a él dentro del mapeo (en un lote, al buffer de ese lugar). Al llegar al final
+ *        prepara un último frame con el CRC del archivo completo.
+ *
+ * @return false si no se pudo leer el cacho; la transferencia queda marcada como fallida.
+ */
+static bool transfer_fill(Server* const server, Transfer* const transfer) {
+    const uint32_t slot = transfer->filled % server->window_size;
+    Frame* const frame = &transfer->window[slot];
+    const size_t offset = (size_t)transfer->filled * transfer->payload_size;
+
+    frame->seqnum = transfer->filled;
+    if (offset < transfer->map_size)
+    {
+        const size_t remaining = transfer->map_size - offset;
+        const size_t size = remaining < transfer->payload_size ? remaining : transfer->payload_size;
+        const uint32_t ring_slot = transfer->filled % (2 * server->window_size);
+        const CompressedChunk* const chunk = transfer->compressed != NULL ? &transfer->compressed_chunks[ring_slot] : NULL;
+
+        // Si el compresor ya lo achicó sale comprimido; si no, tal cual, sin esperarlo
+        if (chunk != NULL && __atomic_load_n(&chunk->stamp, __ATOMIC_ACQUIRE) == transfer->filled + 1 && chunk->length > 0)
+        {
+            frame->packet.data = (char*)transfer->compressed + (size_t)ring_slot * transfer->payload_size;
+            frame->packet.size = frame->items = chunk->length;
+            frame->flags = FRAME_COMPRESSED;
+            frame_seal(frame);
+            transfer->file_crc = crc32_combine(transfer->file_crc, chunk->crc, size);
+            transfer->compressed_frames++;
+            server->stats.compressed_frames++;
+        }
+        else
+        {
+            unsigned char* const buffer = transfer->batch_buffers != NULL ? transfer->batch_buffers + (size_t)(1 + slot) * transfer->payload_size : NULL;
+            const unsigned char* const raw = transfer_chunk(transfer, &transfer->batch_cursor, transfer->filled, size, buffer);
+            if (raw == NULL)
+            {
+                transfer->failed = true;
+                return false;
+            }
+
+            // Calcular el CRC es lo primero que lee el mapeo: un archivo truncado falla aquí
+            sigjmp_buf fault;
+            if (sigsetjmp(fault, 0) != 0)
+            {
+                mapping_fault = NULL;
+                transfer->failed = true;
+                return false;
+            }
+            mapping_fault = &fault;
+            const uint32_t payload_crc = transfer_chunk_crc(transfer, transfer->filled, raw, size);
+            mapping_fault = NULL;
+
+            frame->packet.data = (char*)raw;
+            frame->packet.size = frame->items = size;
+            frame->flags = 0;
+            frame_seal_crc(frame, payload_crc);
+            transfer->file_crc = crc32_combine(transfer->file_crc, payload_crc, frame->items);
+        }
+        transfer->raw_bytes += size;
+        transfer->wire_bytes += frame->items;
+        server->stats.raw_bytes += size;
+        server->stats.wire_bytes += frame->items;
+    }
+    else
+    {
+        transfer->file_crc_net = htonl(transfer->file_crc);
+        frame->packet.data = (char*)&transfer->file_crc_net;
+        frame->packet.size = frame->items = sizeof transfer->file_crc_net;
+        frame->flags = FRAME_LAST;
+        frame_seal(frame);
+        transfer->last_read = true;
+    }
+    transfer->acked[slot] = false;
+    transfer->resent[slot] = false;
+
+    transfer->filled++;
+    return true;
+}
+
+/**
+ * @brief Envía los frames de paridad FEC del bloque que empieza en 'first', calculados
+ *        del archivo mapeado. La paridad no entra en la ventana: no se confirma ni se
+ *        reenvía, y si el socket está lleno se pierde y el bloque queda en manos del ARQ.
+ *
+ * @return Los bytes enviados.
+ */
+static size_t transfer_send_parity(Server* const server, Transfer* const transfer, const uint32_t first) {
+    const FecCode* const code = &server->fec;
+    const unsigned char* data[fec_max_k];
+    size_t lengths[fec_max_k];
+    Frame* frames[fec_max_m];
+
+    // Si el archivo se truncó, codificar el bloque provoca SIGBUS al leer el mapeo
+    sigjmp_buf fault;
+    if (sigsetjmp(fault, 0) != 0)
+    {
+        mapping_fault = NULL;
+        transfer->failed = true;
+        return 0;
+    }
+
+    // El último bloque puede ser más corto, y su último cacho también; la paridad
+    // mide lo que el primer cacho del bloque (en un lote se vuelven a leer, porque
+    // los lugares de la ventana pueden tenerlos comprimidos)
+    unsigned int count = 0;
+    for (size_t offset = (size_t)first * transfer->payload_size; count < code->k && offset < transfer->map_size; offset += transfer->payload_size)
+    {
+        unsigned char* const buffer =
+            transfer->batch_buffers != NULL ? transfer->batch_buffers + (size_t)(1 + server->window_size + count) * transfer->payload_size : NULL;
+        lengths[count] = transfer->map_size - offset < transfer->payload_size ? transfer->map_size - offset : transfer->payload_size;
+        data[count] = transfer_chunk(transfer, &transfer->batch_cursor, first + count, lengths[count], buffer);
+        if (data[count] == NULL)
+        {
+            transfer->failed = true;
+            return 0;
+        }
+        count++;
+    }
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    mapping_fault = &fault;
+    for (unsigned int j = 0; j < code->m; j++)
+    {
+        Frame* const frame = &transfer->parity_frames[j];
+        frame->seqnum = first;
+        frame->ack = (int32_t)j;
+        frame->flags = FRAME_PARITY;
+        frame->packet.data = (char*)transfer->parity + j * transfer->payload_size;
+        frame->packet.size = frame->items = lengths[0];
+        fec_encode(code, j, data, lengths, count, (unsigned char*)frame->packet.data, lengths[0]);
+        frame_seal(frame);
+        frames[j] = frame;
+    }
+    mapping_fault = NULL;
+
+    server->stats.send_calls++;
+    const int sent = frame_send_batch(server->sock_fd, frames, code->m, &transfer->client, 0);
+    if (sent <= 0)
+    {
+        return 0;
+    }
+    log_debug("[+] Paridad enviada. Bloque %u, frames: %d\n", first / code->k, sent);
+    server->stats.parity_sent += (unsigned long)sent;
+    return (size_t)sent * (lengths[0] + sizeof(FrameHeader));
+}
+
+/**
+ * @brief El primer seqnum después del bloque FEC de 'seq'. Sin FEC cada frame es
+ *        su propio bloque.
+ */
+static uint32_t fec_block_end(const Server* const server, const uint32_t seq) {
+    return server->fec.scheme == FEC_NONE ? seq + 1 : (seq / server->fec.k + 1) * server->fec.k;
+}
+
+/**
+ * @brief Cuántos frames puede tener en vuelo una transferencia: lo que permita la
+ *        ventana de ARQ y la de congestión, y al menos uno.
+ */
+static uint32_t transfer_limit(const Server* const server, const Transfer* const transfer) {
+    return transfer->cc.cwnd < 1 ? 1 : transfer->cc.cwnd > server->window_size ? server->window_size : (uint32_t)transfer->cc.cwnd;
+}
+
+/**
+ * @brief Lo que deja enviar la ventana que anunció el cliente, contado desde 'base'.
+ *        Con la ventana cerrada sale de todos modos un frame, que el cliente confirma
+ *        cuando tenga lugar y así anuncia que se volvió a abrir.
+ */
+static uint32_t transfer_rwnd_limit(const Transfer* const transfer) {
+    if (!transfer->rwnd_known)
+    {
+        return UINT32_MAX;
+    }
+    return (int32_t)(transfer->rwnd_edge - transfer->base) <= 1 ? 1 : transfer->rwnd_edge - transfer->base;
+}
+
+/**
+ * @brief Envía frames nuevos mientras quepan en la ventana y lo permita su ritmo.
+ *        Si el socket se llena, se detiene y el servidor espera a EPOLLOUT; si se
+ *        adelanta a su ritmo, espera en la rueda de pacing.
+ */
+static void transfer_pump(Server* const server, Transfer* const transfer) {
+    Frame* batch[frame_batch_max];
+    const uint32_t cwnd_limit = transfer_limit(server, transfer);
+    const uint32_t rwnd_limit = transfer_rwnd_limit(transfer);
+    const uint32_t limit = rwnd_limit < cwnd_limit ? rwnd_limit : cwnd_limit;
+    if (rwnd_limit < cwnd_limit && transfer->next - transfer->base >= limit)
+    {
+        transfer->rwnd_limited++;
+        server->stats.rwnd_limited++;
+    }
+
+    compressor_kick(server, transfer);
+
+    while (transfer->next - transfer->base < limit && !transfer->in_wheel && !transfer->failed)
+    {
+        // Con ritmo de envío, sale a lo más una ráfaga corta y se programa la siguiente
+        const long now_us = monotonic_us();
+        const double rate = transfer->cc.pacing_rate;
+        size_t budget = SIZE_MAX;
+        if (rate > 0)
+        {
+            if (transfer->pace_at_us > now_us)
+            {
+                wheel_schedule(server, transfer, transfer->pace_at_us);
+                server->stats.paced++;
+                return;
+            }
+            budget = (size_t)(rate * pacing_burst_us / 1e6);
+        }
+
+        // Juntamos (leyendo del archivo si hace falta) un lote de frames que quepan en la ventana
+        size_t count = 0;
+        size_t bytes = 0;
+        while (count < frame_batch_max && transfer->next + count - transfer->base < limit && (count == 0 || bytes < budget))
+        {
+            const uint32_t seq = transfer->next + (uint32_t)count;
+            if (seq == transfer->filled)
+            {
+                if (transfer->last_read || !transfer_fill(server, transfer))
+                {
+                    break;
+                }
+            }
+            batch[count] = &transfer->window[seq % server->window_size];
+            bytes += batch[count]->items + sizeof(FrameHeader);
+            count++;
+        }
+        if (count == 0)
+        {
+            return;
+        }
+
+        const size_t sent = send_file_chunks(server, batch, count, &transfer->client);
+        const int send_errno = errno;
+        size_t sent_bytes = 0;
+        for (size_t i = 0; i < sent; i++)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &transfer->sent_at[transfer->next % server->window_size]);
+            log_debug("[+] Mensaje enviado. Seqnum %u, bytes: %zu\n", batch[i]->seqnum, batch[i]->items);
+            transfer->msg_counter++;
+            transfer->next++;
+            server->stats.frames_sent++;
+            server->stats.bytes_sent += batch[i]->items;
+            sent_bytes += batch[i]->items + sizeof(FrameHeader);
+
+            // Al salir el último cacho de un bloque sale su paridad
+            const uint32_t seq = batch[i]->seqnum;
+            if (server->fec.scheme != FEC_NONE && !(batch[i]->flags & FRAME_LAST) &&
+                (seq + 1 == fec_block_end(server, seq) || (size_t)(seq + 1) * transfer->payload_size >= transfer->map_size))
+            {
+                sent_bytes += transfer_send_parity(server, transfer, seq - seq % server->fec.k);
+            }
+        }
+        if (rate > 0)
+        {
+            const long start_us = transfer->pace_at_us > now_us ? transfer->pace_at_us : now_us;
+            transfer->pace_at_us = start_us + (long)((double)sent_bytes * 1e6 / rate);
+        }
+        if (sent < count)
+        {
+            if (send_errno == EAGAIN || send_errno == EWOULDBLOCK)
+            {
+                server->send_blocked = true;
+            }
+            // El kernel no pudo leer el mapeo: el archivo se truncó después de mapearlo
+            transfer->failed |= send_errno == EFAULT;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Reenvía un lote de frames de la ventana.
+ * 
+ * @return Cuántos se reenviaron; menos que 'count' si el socket se llenó.
+ */
+static size_t resend_batch(Server* const server, Transfer* const transfer, Frame* const* const batch, const size_t count) {
+    const size_t sent = send_file_chunks(server, batch, count, &transfer->client);
+    transfer->failed |= sent < count && errno == EFAULT;
+    for (size_t i = 0; i < sent; i++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &transfer->sent_at[batch[i]->seqnum % server->window_size]);
+        transfer->resent[batch[i]->seqnum % server->window_size] = true;
+        log_debug("[+] Mensaje re-enviado. Seqnum %u, bytes: %zu\n", batch[i]->seqnum, batch[i]->items);
+        transfer->msg_counter++;
+        server->stats.frames_resent++;
+        server->stats.bytes_sent += batch[i]->items;
+    }
+    return sent;
+}
+
+/**
+ * @brief Incorpora una muestra de RTT a la estimación de la transferencia (RFC 6298).
+ * 
+ * @param transfer La transferencia.
+ * @param rtt_us El tiempo entre el envío de un frame y su ack, en microsegundos.
+ */
+static void transfer_rtt_sample(Transfer* const transfer, const long rtt_us) {
+    if (transfer->rtt_samples == 0)
+    {
+        transfer->srtt_us = rtt_us;
+        transfer->rttvar_us = rtt_us / 2;
+    }
+    else
+    {
+        const long delta = transfer->srtt_us > rtt_us ? transfer->srtt_us - rtt_us : rtt_us - transfer->srtt_us;
+        transfer->rttvar_us = (3 * transfer->rttvar_us + delta) / 4;
+        transfer->srtt_us = (7 * transfer->srtt_us + rtt_us) / 8;
+    }
+    transfer->rtt_samples++;
+
+    // RTO = SRTT + max(G, 4 * RTTVAR), con G la resolución del temporizador.
+    // Una muestra nueva también deshace el backoff
+    const long variance = 4 * transfer->rttvar_us > tick_min_us ? 4 * transfer->rttvar_us : tick_min_us;
+    const long rto_us = transfer->srtt_us + variance;
+    transfer->rto_us = rto_us < rto_min_us ? rto_min_us : rto_us > rto_max_us ? rto_max_us : rto_us;
+    transfer->backoffs = 0;
+}
+
+/**
+ * @brief Reenvía lo que el cliente reporta perdido. En Go-Back-N el cliente descartó
+ *        todo lo que llegó después de 'base', así que se reenvía la ventana a partir de él.
+ *        En Selective Repeat sólo los huecos que el mapa SACK deja debajo de al menos
+ *        'dupack_threshold' frames confirmados (RFC 6675), cada uno una sola vez salvo
+ *        'base', que se reenvía siempre que se detecta la pérdida. Con FEC sólo cuentan
+ *        los frames después del bloque del hueco: antes llegó (o se perdió) su paridad.
+ *
+ * @param server El servidor.
+ * @param transfer La transferencia.
+ * @param with_base Si se reenvía 'base' aunque ya se haya reenviado.
+ */
+static void resend_lost(Server* const server, Transfer* const transfer, const bool with_base) {
+    Frame* batch[frame_batch_max];
+    size_t count = 0;
+    if (server->mode != MODE_SR)
+    {
+        for (uint32_t seq = transfer->base; seq != transfer->next && count < frame_batch_max; seq++)
+        {
+            batch[count++] = &transfer->window[seq % server->window_size];
+        }
+        resend_batch(server, transfer, batch, count);
+        return;
+    }
+
+    uint32_t sacked_above = 0;
+    uint32_t sacked_beyond = 0;
+    for (uint32_t seq = transfer->sack_high; (int32_t)(seq - transfer->base) > 0; seq--)
+    {
+        const uint32_t slot = (seq - 1) % server->window_size;
+        if (seq == fec_block_end(server, seq - 1))
+        {
+            sacked_beyond = sacked_above;
+        }
+        if (transfer->acked[slot])
+        {
+            sacked_above++;
+            continue;
+        }
+        if (sacked_beyond < dupack_threshold || (transfer->resent[slot] && !(with_base && seq - 1 == transfer->base)))
+        {
+            continue;
+        }
+        batch[count++] = &transfer->window[slot];
+        if (count == frame_batch_max)
+        {
+            resend_batch(server, transfer, batch, count);
+            count = 0;
+        }
+    }
+    if (with_base && sacked_beyond < dupack_threshold)
+    {
+        // Sin SACK suficiente (p. ej. ack duplicados sin mapa), 'base' es lo único seguro
+        batch[count++] = &transfer->window[transfer->base % server->window_size];
+    }
+    resend_batch(server, transfer, batch, count);
+}
+
+/**
+ * @brief Reenvía los frames de la ventana cuyo temporizador ya expiró.
+ *        En Go-Back-N (y stop-and-wait) se reenvía toda la ventana a partir de 'base';
+ *        en Selective Repeat sólo los frames sin confirmar que expiraron.
+ *        Cada expiración duplica el RTO de la transferencia.
+ *
+ * @param server El servidor.
+ * @param transfer La transferencia a revisar.
+ */
+static void resend_expired(Server* const server, Transfer* const transfer)
+{
+    if (transfer->base == transfer->next)
+    {
+        return;
+    }
+
+    // En Go-Back-N basta con que expire el frame más antiguo
+    if (server->mode != MODE_SR && elapsed_us(&transfer->sent_at[transfer->base % server->window_size]) < transfer->rto_us)
+    {
+        return;
+    }
+
+    // Juntamos los frames a reenviar en lotes; si el socket está lleno se reintenta en el siguiente tick
+    Frame* batch[frame_batch_max];
+    size_t count = 0;
+    size_t resent = 0;
+    for (uint32_t seq = transfer->base; seq != transfer->next; seq++)
+    {
+        const uint32_t slot = seq % server->window_size;
+        if (server->mode == MODE_SR && (transfer->acked[slot] || elapsed_us(&transfer->sent_at[slot]) < transfer->rto_us))
+        {
+            continue;
+        }
+
+        batch[count++] = &transfer->window[slot];
+        if (count == frame_batch_max)
+        {
+            const size_t sent = resend_batch(server, transfer, batch, count);
+            resent += sent;
+            count = 0;
+            if (sent < frame_batch_max)
+            {
+                break;
+            }
+        }
+    }
+    if (count > 0)
+    {
+        resent += resend_batch(server, transfer, batch, count);
+    }
+
+    // Backoff exponencial: una vez por expiración (no por frame) y sólo si algo salió;
+    // con el socket lleno se reintenta en el siguiente tick con el mismo RTO
+    if (resent > 0)
+    {
+        transfer->rto_us = transfer->rto_us * 2 < rto_max_us ? transfer->rto_us * 2 : rto_max_us;
+        transfer->backoffs++;
+        server->stats.timeouts++;
+        transfer->cc.ops->on_loss(&transfer->cc, CC_LOSS_TIMEOUT, transfer->next - transfer->base);
+        transfer->dupacks = 0;
+        server->stats.loss_events++;
+    }
+}
+
+/**
+ * @brief Procesa el acknowledgement de una transferencia.
+ * 
+ * @param server El servidor.
+ * @param transfer La transferencia a la que pertenece el ack.
+ * @param ack El ack, ya verificado.
+ * @return true si la transferencia terminó y fue destruida.
+ */
+static bool transfer_on_ack(Server* const server, Transfer* const transfer, const Frame* const ack) {
+    transfer->ack_counter++;
+    server->stats.acks++;
+    clock_gettime(CLOCK_MONOTONIC, &transfer->last_ack);
+
+    // Recibir un ack negativo significa que acabamos.
+    // El cliente nos regresa el CRC del archivo que escribió
+    if (ack->ack == -1) 
+    {
+        uint32_t client_crc = 0;
+        if (ack->items == sizeof client_crc)
+        {
+            memcpy(&client_crc, ack->packet.data, sizeof client_crc);
+            client_crc = ntohl(client_crc);
+        }
+
+        // El resumen sale después de lo que quede en el registro de esta transferencia
+        log_sync();
+        printf("[+] Archivo \"%s\" enviado a %s:%d.\n", transfer->filename, inet_ntoa(transfer->client.sin_addr), ntohs(transfer->client.sin_port));
+        if (ack->items == sizeof client_crc && client_crc == transfer->file_crc)
+        {
+            printf("[+] Integridad confirmada por el cliente (CRC-32 %08x).\n", transfer->file_crc);
+            if (transfer->index_build != NULL && crc_index_write(transfer->filename, transfer->payload_size, &transfer->file_stat, transfer->index_build))
+            {
+                printf("[+] Índice de CRC de \"%s\" guardado.\n", transfer->filename);
+            }
+        }
+        else
+        {
+            printf("[-] El cliente reporta un CRC distinto (%08x, esperado %08x).\n", client_crc, transfer->file_crc);
+        }
+
+        // Imprimimos información sobre el archivo obtenido
+        printf("[+] Obtención de archivo \"%s\" finalizada!\n", transfer->filename);
+        printf("Nombre del archivo: %s\n", transfer->filename);
+        printf("Tamaño del archivo: %zu bytes.\n", transfer->file_size);
+        if (transfer->map_size != transfer->file_size)
+        {
+            printf("Tamaño del rango: %zu bytes.\n", transfer->map_size);
+        }
+        if (transfer->batch_files > 0)
+        {
+            printf("Archivos del lote: %zu.\n", transfer->batch_files);
+        }
+        if (transfer->cached != NULL)
+        {
+            printf("Caché: %s.\n", transfer->cache_hit ? "acierto" : "fallo");
+        }
+        if (transfer->compressed != NULL)
+        {
+            printf("Comprimidos con LZ4: %lu frames, %llu bytes en %llu (razón %.2f).\n", transfer->compressed_frames, transfer->raw_bytes,
+                   transfer->wire_bytes, transfer->wire_bytes > 0 ? (double)transfer->raw_bytes / (double)transfer->wire_bytes : 1.0);
+        }
+        printf("Tamaño del buffer: %zu bytes.\n", transfer->payload_size);
+        printf("CRC-32 del archivo: %08x.\n", transfer->file_crc);
+        printf("Modo: %s, ventana: %u frames.\n", mode_name(server->mode), server->window_size);
+        printf("Total de mensajes enviados (DATA): %d.\n", transfer->msg_counter);
+        printf("Total de confirmaciones recibidas (ACK): %d.\n", transfer->ack_counter);
+        printf("RTT suavizado: %.3f ms (variación %.3f ms, %lu muestras), RTO: %.3f ms.\n", transfer->srtt_us / 1000.0,
+               transfer->rttvar_us / 1000.0, transfer->rtt_samples, transfer->rto_us / 1000.0);
+        printf("Control de congestión: %s, cwnd %.1f frames, ritmo %.2f MB/s, %lu pérdidas.\n", transfer->cc.ops->name,
+               transfer->cc.cwnd, transfer->cc.pacing_rate / 1e6, transfer->cc.loss_events);
+        if (transfer->rwnd_known)
+        {
+            printf("Ventana del cliente: %u frames (frenó el envío %lu veces).\n", transfer->rwnd, transfer->rwnd_limited);
+        }
+        printf("[+] Listo...\n");
+
+        server->stats.completed++;
+        transfer_destroy(server, transfer);
+        return true;
+    }
+
+    // El ack confirma el frame 'seqnum'; si sigue en vuelo y nunca se reenvió, su tiempo
+    // de ida y vuelta es una muestra de RTT sin ambigüedad (regla de Karn).
+    // En Selective Repeat el ack también confirma el frame individual
+    const uint32_t in_flight = transfer->next - transfer->base;
+    size_t newly_acked = 0;
+    long rtt_us = -1;
+    if (ack->seqnum - transfer->base < transfer->next - transfer->base)
+    {
+        const uint32_t slot = ack->seqnum % server->window_size;
+        if (!transfer->resent[slot] && !transfer->acked[slot])
+        {
+            rtt_us = elapsed_us(&transfer->sent_at[slot]);
+            transfer_rtt_sample(transfer, rtt_us);
+        }
+        if (server->mode == MODE_SR && !transfer->acked[slot])
+        {
+            transfer->acked[slot] = true;
+            newly_acked++;
+        }
+    }
+
+    // La ventana del cliente viaja en los últimos bytes de la carga útil, después del mapa SACK
+    size_t sack_items = ack->items;
+    if ((ack->flags & FRAME_RWND) && ack->items >= rwnd_bytes)
+    {
+        uint16_t rwnd_net;
+        sack_items -= rwnd_bytes;
+        memcpy(&rwnd_net, (const uint8_t*)ack->packet.data + sack_items, sizeof rwnd_net);
+        transfer->rwnd = ntohs(rwnd_net);
+        transfer->rwnd_edge = (uint32_t)ack->ack + transfer->rwnd;
+        transfer->rwnd_known = true;
+    }
+
+    // En Selective Repeat el mapa SACK confirma además los frames recibidos después del hueco
+    uint32_t sacked = 0;
+    if (server->mode == MODE_SR && (ack->flags & FRAME_SACK) && sack_items <= sack_bytes_max)
+    {
+        const uint8_t* const bitmap = (const uint8_t*)ack->packet.data;
+        for (uint32_t i = 0; i < sack_items * 8; i++)
+        {
+            const uint32_t seq = (uint32_t)ack->ack + 1 + i;
+            if (!(bitmap[i / 8] & (1u << (i % 8))) || seq - transfer->base >= transfer->next - transfer->base)
+            {
+                continue;
+            }
+            sacked++;
+            if (!transfer->acked[seq % server->window_size])
+            {
+                transfer->acked[seq % server->window_size] = true;
+                newly_acked++;
+            }
+            if ((int32_t)(seq + 1 - transfer->sack_high) > 0)
+            {
+                transfer->sack_high = seq + 1;
+            }
+        }
+    }
+
+    // Deslizamos la ventana con el ack acumulativo
+    while (transfer->base != transfer->next &&
+           ((int32_t)(transfer->base - (uint32_t)ack->ack) < 0 || transfer->acked[transfer->base % server->window_size]))
+    {
+        newly_acked += transfer->acked[transfer->base % server->window_size] ? 0 : 1;
+        transfer->base++;
+    }
+
+    // Un ack acumulativo repetido con frames en vuelo significa que al cliente le falta 'base'.
+    // Al tercero (o con tres frames confirmados por SACK después del hueco) se reenvía sin
+    // esperar al RTO; la pérdida cuenta una vez por ventana y, mientras se recupera,
+    // cada mapa SACK nuevo puede descubrir más huecos
+    if (ack->ack == transfer->last_cumulative_ack && transfer->base != transfer->next)
+    {
+        // Con FEC se espera a que el SACK pase del bloque de 'base', cuya paridad puede
+        // reconstruirlo sin reenvío
+        transfer->dupacks++;
+        const bool lost = server->fec.scheme == FEC_NONE ? transfer->dupacks >= dupack_threshold || sacked >= dupack_threshold :
+                          (int32_t)(transfer->sack_high - fec_block_end(server, transfer->base)) >= dupack_threshold;
+        if (lost && !transfer->cc.in_recovery &&
+            (int32_t)(transfer->base - transfer->recover) >= 0)
+        {
+            transfer->cc.ops->on_loss(&transfer->cc, CC_LOSS_DUPACK, transfer->next - transfer->base);
+            transfer->recover = transfer->next;
+            server->stats.loss_events++;
+            server->stats.fast_retransmits++;
+            resend_lost(server, transfer, true);
+        }
+        else if (sacked > 0 && (int32_t)(transfer->base - transfer->recover) < 0)
+        {
+            resend_lost(server, transfer, false);
+        }
+    }
+    else if ((int32_t)((uint32_t)ack->ack - (uint32_t)transfer->last_cumulative_ack) > 0)
+    {
+        transfer->last_cumulative_ack = ack->ack;
+        transfer->dupacks = 0;
+        if (transfer->cc.in_recovery && (int32_t)(transfer->base - transfer->recover) >= 0)
+        {
+            transfer->cc.ops->on_recovered(&transfer->cc);
+        }
+        else if (server->mode == MODE_SR && (int32_t)(transfer->base - transfer->recover) < 0)
+        {
+            // Ack parcial durante la recuperación: quedan huecos por reenviar
+            resend_lost(server, transfer, false);
+        }
+    }
+
+    transfer->cc.ops->on_ack(&transfer->cc, newly_acked, in_flight, rtt_us, transfer->srtt_us, monotonic_us());
+    return false;
+}
+
+/**
+ * @brief Atiende la solicitud de un cliente: un path, opcionalmente seguido de
+ *        parámetros en la siguiente línea, p. ej. "archivo\nsize=8192 range=0:1048576".
+ *        Con "range=<offset>:<largo>" sólo se envía ese rango, para que el cliente pueda
+ *        descargar un archivo con varios flujos en paralelo.
+ *        Contesta "200 ..." e inicia la transferencia, o "404".
+ */
+static void handle_request(Server* const server, char* const buffer, const struct sockaddr_in* const client_config) {
+    char response[192];
+
+    char* const params = strchr(buffer, '\n');
+    if (params != NULL)
+    {
+        *params = '\0';
+    }
+
+    // Un cliente que vuelve a pedir un archivo reemplaza su transferencia anterior
+    Transfer* const previous = transfer_find(server, client_config);
+    if (previous != NULL)
+    {
+        transfer_destroy(server, previous);
+    }
+
+    // Con "batch=1" el path es un patrón o un directorio y se envía un lote de archivos
+    const char* const batch_value = params != NULL ? handshake_value(params + 1, "batch") : NULL;
+    const bool batch = batch_value != NULL && strtol(batch_value, NULL, 10) != 0;
+    if (!batch && !check_file_exists(buffer))
+    {
+        send_response(server->sock_fd, "404", client_config);
+        return;
+    }
+
+    // La carga útil es la menor entre la que pide el cliente y la que permite el servidor
+    const char* const size_value = params != NULL ? handshake_value(params + 1, "size") : NULL;
+    long payload_size = size_value != NULL ? strtol(size_value, NULL, 10) : size_default;
+    if (payload_size < 1 || payload_size > (long)server->max_payload)
+    {
+        payload_size = (long)server->max_payload;
+    }
+
+    // Sin rango se envía el archivo completo
+    size_t offset = 0;
+    size_t length = SIZE_MAX;
+    const char* const range_value = params != NULL ? handshake_value(params + 1, "range") : NULL;
+    if (range_value != NULL)
+    {
+        char* end;
+        offset = (size_t)strtoull(range_value, &end, 10);
+        length = *end == ':' ? (size_t)strtoull(end + 1, NULL, 10) : SIZE_MAX;
+    }
+
+    Transfer* const transfer = transfer_create(server, client_config, buffer, (size_t)payload_size);
+    if (transfer == NULL || !(batch ? transfer_map_batch(server, transfer, buffer) : transfer_map_file(server, transfer, buffer, offset, length)))
+    {
+        printf("Unable to open file %s to read\n", buffer);
+        send_response(server->sock_fd, "404", client_config);
+        if (transfer != NULL)
+        {
+            transfer_destroy(server, transfer);
+        }
+        return;
+    }
+
+    // El cliente necesita conocer el modo, la ventana y la carga útil para sus buffers,
+    // y los tamaños del rango y del archivo para reservarlo y escribir cada cacho en su lugar.
+    // La fecha de modificación identifica la versión del archivo, para reanudar sin mezclar dos
+    printf("[+] Sending file \"%s\" to %s:%d (modo %s, ventana %u, %zu bytes).\n", buffer, inet_ntoa(client_config->sin_addr),
+           ntohs(client_config->sin_port), mode_name(server->mode), server->window_size, transfer->map_size);
+    int response_len = snprintf(response, sizeof response, "200 mode=%s window=%u size=%ld length=%zu total=%zu", mode_name(server->mode),
+                                server->window_size, payload_size, transfer->map_size, transfer->file_size);
+    if (server->fec.scheme != FEC_NONE)
+    {
+        response_len += snprintf(response + response_len, sizeof response - response_len, " fec=");
+        response_len += fec_format(&server->fec, response + response_len, sizeof response - response_len);
+    }
+    if (transfer->batch_files > 0)
+    {
+        response_len += snprintf(response + response_len, sizeof response - response_len, " batch=%zu", transfer->batch_files);
+    }
+    else
+    {
+        response_len += snprintf(response + response_len, sizeof response - response_len, " mtime=%lld.%09ld",
+                                 (long long)transfer->file_stat.st_mtim.tv_sec, (long)transfer->file_stat.st_mtim.tv_nsec);
+    }
+    if (server->compress && compressor_add(server, transfer))
+    {
+        snprintf(response + response_len, sizeof response - response_len, " compress=lz4");
+    }
+    if (send_response(server->sock_fd, response, client_config) < 0)
+    {
+        // Sin respuesta no hay transferencia; el cliente repetirá la solicitud
+        transfer_destroy(server, transfer);
+        return;
+    }
+    server->stats.transfers++;
+    transfer_pump(server, transfer);
+}
+
+/**
+ * @brief Lee todos los datagramas pendientes del socket.
+ */
+static void handle_datagrams(Server* const server) {
+    struct sockaddr_in client_configs[frame_batch_max];
+    size_t lengths[frame_batch_max];
+    Frame frame;
+    uint32_t payload_crc;
+    int received;
+
+    do
+    {
+        received = recv_datagrams(server->sock_fd, server->recv_buffers, lengths, client_configs, frame_batch_max);
+        server->stats.recv_calls++;
+        for (int i = 0; i < received; i++)
+        {
+            char* const buffer = server->recv_buffers[i];
+
+            // Un frame válido es un ack; cualquier otra cosa es la solicitud de un archivo
+            if (frame_decode(&frame, buffer, lengths[i]))
+            {
+                Transfer* const transfer = transfer_find(server, &client_configs[i]);
+                if (transfer == NULL)
+                {
+                    continue;
+                }
+                if (!frame_verify(&frame, &payload_crc))
+                {
+                    log_warn("[-] Ack corrupto, descartado.\n");
+                    continue;
+                }
+
+                // Se envía después de procesar el lote, para que los acks juntos
+                // liberen varios frames y salgan en una sola llamada
+                if (!transfer_on_ack(server, transfer, &frame) && !transfer->pump_pending)
+                {
+                    transfer->pump_pending = true;
+                    server->pending[server->pending_count++] = transfer;
+                }
+            }
+            else if (lengths[i] > 0)
+            {
+                handle_request(server, buffer, &client_configs[i]);
+            }
+        }
+
+        while (server->pending_count > 0)
+        {
+            Transfer* const transfer = server->pending[--server->pending_count];
+            transfer->pump_pending = false;
+            transfer_pump(server, transfer);
+        }
+    } while (received == frame_batch_max);
+}
+
+/**
+ * @brief Lee las notificaciones de MSG_ZEROCOPY de la cola de errores del socket.
+ *        Las páginas fijadas son del archivo mapeado, que no cambia mientras se envía,
+ *        así que sólo hay que vaciar la cola (si se llena, los envíos fallan con ENOBUFS).
+ */
+static void handle_errqueue(Server* const server) {
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+    struct msghdr message = {.msg_control = control, .msg_controllen = sizeof control};
+
+    while (recvmsg(server->sock_fd, &message, MSG_ERRQUEUE | MSG_DONTWAIT) >= 0)
+    {
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL; cmsg = CMSG_NXTHDR(&message, cmsg))
+        {
+            const struct sock_extended_err* const error = (const struct sock_extended_err*)CMSG_DATA(cmsg);
+            if (error->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+            {
+                continue;
+            }
+
+            // Cada notificación confirma el rango de envíos [ee_info, ee_data]
+            const unsigned long sends = error->ee_data - error->ee_info + 1;
+            server->stats.zerocopy_sends += sends;
+            if (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            {
+                server->stats.zerocopy_copied += sends;
+            }
+        }
+        message.msg_controllen = sizeof control;
+    }
+}
+
+/**
+ * @brief Vuelve a intentar los envíos que se detuvieron porque el socket estaba lleno.
+ */
+static void handle_writable(Server* const server) {
+    server->send_blocked = false;
+    for (size_t i = 0; i < server->bucket_count && !server->send_blocked; i++)
+    {
+        for (Transfer* transfer = server->buckets[i]; transfer != NULL && !server->send_blocked; transfer = transfer->next_in_bucket)
+        {
+            transfer_pump(server, transfer);
+        }
+    }
+}
+
+/**
+ * @brief Tick del temporizador: reenvía los frames expirados y descarta a los
+ *        clientes que dejaron de responder.
+ */
+static void handle_timer(Server* const server) {
+    uint64_t expirations;
+    if (read(server->timer_fd, &expirations, sizeof expirations) < 0)
+    {
+        return;
+    }
+
+    server->shortest_rto_us = rto_max_us;
+    for (size_t i = 0; i < server->bucket_count; i++)
+    {
+        Transfer* transfer = server->buckets[i];
+        while (transfer != NULL)
+        {
+            Transfer* const following = transfer->next_in_bucket;
+            if (transfer->rto_us < server->shortest_rto_us)
+            {
+                server->shortest_rto_us = transfer->rto_us;
+            }
+            if (transfer->failed)
+            {
+                fprintf(stderr, "[-] No se pudo leer \"%s\" para %s:%d, se descarta la transferencia.\n",
+                        transfer->filename, inet_ntoa(transfer->client.sin_addr), ntohs(transfer->client.sin_port));
+                server->stats.dropped++;
+                transfer_destroy(server, transfer);
+            }
+            else if (elapsed_us(&transfer->last_ack) > idle_timeout_us)
+            {
+                fprintf(stderr, "[-] El cliente %s:%d dejó de responder, se descarta \"%s\".\n",
+                        inet_ntoa(transfer->client.sin_addr), ntohs(transfer->client.sin_port), transfer->filename);
+                server->stats.dropped++;
+                transfer_destroy(server, transfer);
+            }
+            else
+            {
+                resend_expired(server, transfer);
+            }
+            transfer = following;
+        }
+    }
+}
+
+/**
+ * @brief Tick de la rueda de pacing: reanuda las transferencias cuyo turno ya llegó.
+ */
+static void handle_pacing(Server* const server) {
+    uint64_t expirations;
+    if (read(server->pacing_fd, &expirations, sizeof expirations) < 0)
+    {
+        return;
+    }
+
+    TimerWheel* const wheel = &server->wheel;
+    const long now = monotonic_us() / wheel_tick_us;
+    for (long tick = wheel->current + 1; tick <= now && tick - wheel->current <= wheel_slots; tick++)
+    {
+        // Se separa la ranura antes de bombear: transfer_pump() puede volver a programar
+        Transfer* transfer = wheel->slots[tick % wheel_slots];
+        wheel->slots[tick % wheel_slots] = NULL;
+        while (transfer != NULL)
+        {
+            Transfer* const following = transfer->next_in_wheel;
+            transfer->in_wheel = false;
+            wheel->count--;
+            transfer_pump(server, transfer);
+            transfer = following;
+        }
+    }
+    wheel->current = now > wheel->current ? now : wheel->current;
+}
+
+/**
+ * @brief Arma el temporizador mientras haya transferencias en curso y lo desarma si no.
+ *        El tick es una fracción del menor RTO para que los reenvíos sean puntuales.
+ */
+static void update_timer(Server* const server) {
+    long tick_us = 0;
+    if (server->transfer_count > 0)
+    {
+        tick_us = server->shortest_rto_us / 4;
+        tick_us = tick_us < tick_min_us ? tick_min_us : tick_us > tick_max_us ? tick_max_us : tick_us;
+    }
+    if (tick_us == server->timer_tick_us)
+    {
+        return;
+    }
+
+    struct itimerspec spec = {0};
+    spec.it_interval.tv_sec = tick_us / 1000000;
+    spec.it_interval.tv_nsec = (tick_us % 1000000) * 1000;
+    spec.it_value = spec.it_interval;
+    timerfd_settime(server->timer_fd, 0, &spec, NULL);
+    server->timer_tick_us = tick_us;
+}
+
+/**
+ * @brief Arma el tick de la rueda de pacing sólo mientras haya transferencias esperando.
+ */
+static void update_pacing_timer(Server* const server) {
+    const bool armed = server->wheel.count > 0;
+    if (armed == server->pacing_armed)
+    {
+        return;
+    }
+
+    struct itimerspec spec = {0};
+    if (armed)
+    {
+        spec.it_interval.tv_nsec = wheel_tick_us * 1000;
+        spec.it_value = spec.it_interval;
+    }
+    timerfd_settime(server->pacing_fd, 0, &spec, NULL);
+    server->pacing_armed = armed;
+}
+
+/**
+ * @brief Ciclo de eventos de un worker. Atiende a todos sus clientes desde un solo
+ *        hilo: cada cliente tiene su transferencia y nunca se bloquea en un envío.
+ *        Termina cuando se escribe en 'stop_fd'.
+ */
+static void serve(Server* const server) {
+    struct epoll_event event = {.events = EPOLLIN, .data.fd = server->sock_fd};
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->sock_fd, &event);
+    event.data.fd = server->timer_fd;
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->timer_fd, &event);
+    event.data.fd = server->stop_fd;
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->stop_fd, &event);
+    event.data.fd = server->pacing_fd;
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->pacing_fd, &event);
+
+    bool watching_out = false;
+    struct epoll_event events[16];
+    while (1)
+    {
+        const int ready = epoll_wait(server->epoll_fd, events, sizeof events / sizeof events[0], -1);
+        for (int i = 0; i < ready; i++)
+        {
+            if (events[i].data.fd == server->stop_fd)
+            {
+                return;
+            }
+            if (events[i].data.fd == server->timer_fd)
+            {
+                handle_timer(server);
+                continue;
+            }
+            if (events[i].data.fd == server->pacing_fd)
+            {
+                handle_pacing(server);
+                continue;
+            }
+            if (events[i].events & EPOLLERR)
+            {
+                handle_errqueue(server);
+            }
+            if (events[i].events & EPOLLIN)
+            {
+                handle_datagrams(server);
+            }
+            if (events[i].events & EPOLLOUT)
+            {
+                handle_writable(server);
+            }
+        }
+
+        // Sólo nos interesa EPOLLOUT mientras haya envíos detenidos
+        if (server->send_blocked != watching_out)
+        {
+            watching_out = server->send_blocked;
+            event.events = EPOLLIN | (watching_out ? EPOLLOUT : 0);
+            event.data.fd = server->sock_fd;
+            epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, server->sock_fd, &event);
+        }
+        update_timer(server);
+        update_pacing_timer(server);
+    }
+}
+
+/**
+ * @brief Reparte el lugar de una transferencia (y el de su anillo de compresión) para la
+ *        ventana, el FEC y la carga útil más grande que el worker puede negociar, y
+ *        prepara los pools con ese tamaño. Los pools toman memoria al primer uso.
+ */
+static void server_pools_init(Server* const server) {
+    TransferLayout* const layout = &server->layout;
+    const size_t window = server->window_size;
+    const size_t parity = server->fec.scheme != FEC_NONE ? server->fec.m : 0;
+
+    layout->window = pool_round(sizeof(Transfer), pool_align);
+    layout->acked = layout->window + pool_round(window * sizeof(Frame), pool_align);
+    layout->resent = layout->acked + pool_round(window * sizeof(bool), pool_align);
+    layout->sent_at = layout->resent + pool_round(window * sizeof(bool), pool_align);
+    layout->parity_frames = layout->sent_at + pool_round(window * sizeof(struct timespec), pool_align);
+    layout->parity = layout->parity_frames + pool_round(parity * sizeof(Frame), pool_align);
+    layout->size = layout->parity + parity * server->max_payload;
+    layout->compressed = pool_round(2 * window * sizeof(CompressedChunk), pool_align);
+    layout->compress_size = layout->compressed + 2 * window * server->max_payload;
+
+    pool_init(&server->transfer_pool, layout->size, 0, server->huge_pages);
+    pool_init(&server->compress_pool, layout->compress_size, 0, server->huge_pages);
+}
+
+/**
+ * @brief Crea el socket, el epoll y los temporizadores de un worker a partir de la
+ *        configuración común.
+ * 
+ * @param server El worker a inicializar. Ya trae la configuración común.
+ * @param port El puerto compartido por todos los workers.
+ * @return true en éxito.
+ */
+static bool server_init(Server* const server, const int port) {
+    struct sockaddr_in server_config;
+
+    server->sock_fd = bind_socket(port, &server_config);
+    server->epoll_fd = epoll_create1(0);
+    server->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    server->pacing_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    server->wheel.current = monotonic_us() / wheel_tick_us;
+    server->buckets = calloc(transfer_buckets, sizeof(Transfer*));
+    server->bucket_count = transfer_buckets;
+    server->recv_buffers = malloc(frame_batch_max * sizeof *server->recv_buffers);
+    if (server->sock_fd < 0 || server->epoll_fd < 0 || server->timer_fd < 0 || server->pacing_fd < 0 || server->buckets == NULL || server->recv_buffers == NULL)
+    {
+        return false;
+    }
+
+    // Probamos si el kernel acepta UDP_SEGMENT; si luego la ruta no lo soporta se desactiva
+    const int no_segment = 0;
+    server->gso = setsockopt(server->sock_fd, SOL_UDP, UDP_SEGMENT, &no_segment, sizeof no_segment) == 0;
+
+    const int enable = 1;
+    if (server->zerocopy && setsockopt(server->sock_fd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof enable) < 0)
+    {
+        printf("[-] El kernel no soporta MSG_ZEROCOPY (%s); se enviará copiando.\n", strerror(errno));
+        server->zerocopy = false;
+    }
+
+    server_pools_init(server);
+    if (server->compress)
+    {
+        pthread_mutex_init(&server->compressor.lock, NULL);
+        pthread_cond_init(&server->compressor.wake, NULL);
+        pthread_cond_init(&server->compressor.idle, NULL);
+        if (pthread_create(&server->compressor.thread, NULL, compressor_main, server) != 0)
+        {
+            return false;
+        }
+    }
+
+    // Le damos al kernel espacio para varias ventanas completas
+    const int sndbuf = (int)(4 * server->window_size * (server->max_payload + sizeof(FrameHeader)));
+    setsockopt(server->sock_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof sndbuf);
+    return true;
+}
+
+/**
+ * @brief Libera las transferencias pendientes y los descriptores de un worker.
+ */
+static void server_shutdown(Server* const server) {
+    if (server->compress)
+    {
+        pthread_mutex_lock(&server->compressor.lock);
+        server->compressor.stop = true;
+        pthread_cond_signal(&server->compressor.wake);
+        pthread_mutex_unlock(&server->compressor.lock);
+        pthread_join(server->compressor.thread, NULL);
+    }
+    for (size_t i = 0; i < server->bucket_count; i++)
+    {
+        while (server->buckets[i] != NULL)
+        {
+            transfer_destroy(server, server->buckets[i]);
+        }
+    }
+    pool_exit(&server->transfer_pool);
+    pool_exit(&server->compress_pool);
+    free(server->buckets);
+    free(server->recv_buffers);
+    close(server->timer_fd);
+    close(server->pacing_fd);
+    close(server->epoll_fd);
+    close(server->sock_fd);
+}
+
+/**
+ * @brief Hilo de un worker: se fija a su CPU (si se pidió) y atiende su socket.
+ */
+static void* worker_main(void* const arg) {
+    Server* const server = arg;
+
+    if (server->cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(server->cpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof cpus, &cpus);
+    }
+
+    serve(server);
+    return NULL;
+}
+
+/**
+ * @brief Imprime los contadores de un worker.
+ */
+static void print_stats(const Server* const server) {
+    const ServerStats* const stats = &server->stats;
+
+    printf("Worker %d", server->index);
+    if (server->cpu >= 0)
+    {
+        printf(" (CPU %d)", server->cpu);
+    }
+    printf(": transferencias %lu, completadas %lu, descartadas %lu, frames enviados %lu (reenviados %lu en %lu timeouts), acks %lu, bytes %llu, "
+           "llamadas de envío %lu (%s), de recepción %lu",
+           stats->transfers, stats->completed, stats->dropped, stats->frames_sent, stats->frames_resent, stats->timeouts, stats->acks, stats->bytes_sent,
+           stats->send_calls, server->gso ? "GSO" : "sendmmsg", stats->recv_calls);
+    if (server->zerocopy)
+    {
+        printf(", zero-copy %lu (copiados por el kernel %lu)", stats->zerocopy_sends, stats->zerocopy_copied);
+    }
+    printf(", retransmisiones rápidas %lu, pérdidas %lu, esperas de pacing %lu, frenos del cliente %lu", stats->fast_retransmits,
+           stats->loss_events, stats->paced, stats->rwnd_limited);
+    if (server->fec.scheme != FEC_NONE)
+    {
+        printf(", paridad FEC %lu", stats->parity_sent);
+    }
+    if (server->compress)
+    {
+        printf(", comprimidos LZ4 %lu (razón %.2f)", stats->compressed_frames,
+               stats->wire_bytes > 0 ? (double)stats->raw_bytes / (double)stats->wire_bytes : 1.0);
+    }
+    printf(", pool de transferencias: pico %zu de %zu lugares (%.1f MiB)", server->transfer_pool.peak, server->transfer_pool.slots,
+           (double)(server->transfer_pool.slots * server->transfer_pool.slot_size) / (1 << 20));
+    if (server->huge_pages)
+    {
+        printf(", slabs en páginas enormes %lu", server->transfer_pool.huge_slabs + server->compress_pool.huge_slabs);
+    }
+    printf(".\n");
+}
+
+int main(int argc, char **argv)
+{
+    // Revisamos el correcto funcionamiento
+/*    if (argc != 2) {
+        return print_usage();
+    }
+*/
+
+    // Verificamos que el kernel de CRC32 elegido para este CPU coincida con la referencia
+    if (crc32_selftest() != 0)
+    {
+        printf("[-] Falló la autoprueba de CRC32 (kernel %s).\n", crc32_kernel_name());
+        exit(EXIT_FAILURE);
+    }
+    printf("[+] CRC32: kernel %s.\n", crc32_kernel_name());
+
+    char *program_name = argv[0]; // almacenamos el nombre del programa
+
+    long timeout_val = time_default;
+    double e_percent = 1;
+    ArqMode mode = MODE_SW;
+    long window_size = window_default;
+    long max_payload = size_default;
+    long workers = 1;
+    bool pin = false;
+    bool zerocopy = false;
+    bool compress = false;
+    long cache_mib = cache_default_mib;
+    bool build_index = false;
+    bool huge_pages = false;
+    const CcOps *cc_ops = cc_find("reno");
+    FecCode fec = {FEC_NONE, 0, 0};
+
+    // obteniendo argumentos
+    while ((opt = getopt_long(argc, argv, short_options, long_options, NULL)) != -1)
+    {
+        switch(opt)
+        {
+            case 't':
+                timeout_val = strtol(optarg, NULL, 10);
+                if (timeout_val < 1)
+                {
+                    printf("Tiempo de espera no valido: %s\n", optarg);
+                    usage(stdout, program_name);
+                    exit(EXIT_FAILURE);
+                }
+                continue;
+            case 'm':
+                mode = parse_mode(optarg);
+                if ((int)mode == -1)
+                {
+                    printf("Modo no valido: %s\n", optarg);
+                    usage(stdout, program_name);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'w':
+                window_size = strtol(optarg, NULL, 10);
+                if (window_size < 1 || window_size > 1024)
+                {
+                    printf("Ventana no valida: %s\n", optarg);
+                    usage(stdout, program_name);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 's':
+                // Máxima carga útil que el servidor está dispuesto a negociar
+                max_payload = strtol(optarg, NULL, 10);
+                if (max_payload < 1 || max_payload > (long)size_max)
+                {
+                    printf("Carga útil no valida: %s\n", optarg);
+                    usage(stdout, program_name);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'W':
+                workers = strtol(optarg, NULL, 10);
+                if (workers < 1 || workers > workers_max)
+                {
+                    printf("Número de workers no valido: %s\n", optarg);
+                    usage(stdout, program_name);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'P':
+                pin = true;
+                break;
+            case 'z':
+                zerocopy = true;
+                break;
+            case 'C':
+                compress = true;
+                break;
+            case 'I':
+                build_index = true;
+                break;
+            case 'H':
+                huge_pages = true;
+                break;
+            case 'M':
+                cache_mib = strtol(optarg, NULL, 10);
+                if (cache_mib < 0 || cache_mib > (long)(SIZE_MAX >> 20))
+                {
+                    printf("Tamaño de caché no valido: %s\n", optarg);
+                    usage(stdout, program_name);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'F':
+                if (fec_parse(&fec, optarg) < 0)
+                {
+                    printf("Código FEC no valido: %s\n", optarg);
+                    usage(stdout, program_name);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'c':
+                cc_ops = cc_find(optarg);
+                if (cc_ops == NULL)
+                {
+                    printf("Control de congestión no valido: %s\n", optarg);
+                    usage(stdout, program_name);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case ':':
+                printf("Argumento %c no proporcionado\n", optopt);
+                usage(stdout, program_name);
+                exit(EXIT_FAILURE);
+            case 'h':
+                usage(stdout, program_name);
+                exit(EXIT_SUCCESS);
+            case 'v':
+                log_level = LOG_DEBUG;
+                break;
+            case 'e':
+                e_percent = strtod(optarg, NULL);
+                if (e_percent <= 0)
+                {
+                    e_percent = 1;
+                }
+                else if(e_percent > 100)
+                {
+                    printf("porcentaje no valido \n");
+
+                }
+                else{
+                    e_percent = 1-(e_percent/100);
+                }
+                break;
+            default :
+                printf("Argumento desconocido: %c\n", optopt);
+                usage(stdout, program_name);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    // Con -I sólo se generan los índices de los archivos que siguen a las opciones
+    if (build_index)
+    {
+        int failed = 0;
+        for (int i = optind; i < argc; i++)
+        {
+            const bool built = crc_index_build(argv[i], (size_t)max_payload);
+            printf("[%c] Índice de CRC de \"%s\" (%ld bytes por cacho)%s.\n", built ? '+' : '-', argv[i], max_payload, built ? "" : ": no se pudo generar");
+            failed += !built;
+        }
+        exit(failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    // stop-and-wait es una ventana de un solo frame
+    if (mode == MODE_SW)
+    {
+        window_size = 1;
+    }
+
+    // La paridad sólo sirve si el cliente guarda los frames que llegan después de un hueco
+    if (fec.scheme != FEC_NONE)
+    {
+        if (mode != MODE_SR)
+        {
+            printf("FEC requiere el modo sr\n");
+            usage(stdout, program_name);
+            exit(EXIT_FAILURE);
+        }
+        if (fec_selftest() != 0)
+        {
+            printf("[-] Falló la autoprueba de FEC (kernel %s).\n", fec_kernel_name());
+            exit(EXIT_FAILURE);
+        }
+        printf("[+] FEC: kernel %s.\n", fec_kernel_name());
+    }
+    if (compress && lz4_selftest() != 0)
+    {
+        printf("[-] Falló la autoprueba de LZ4.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Un archivo truncado mientras está mapeado falla sólo la transferencia que lo lee
+    struct sigaction fault_action = {0};
+    fault_action.sa_handler = mapping_fault_handler;
+    fault_action.sa_flags = SA_NODEFER;
+    sigaction(SIGBUS, &fault_action, NULL);
+
+    // Las señales de terminación las atiende sólo el hilo principal
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    // Configuramos y activamos los workers, cada uno con su socket en el mismo puerto
+    const int port = 2020;
+    const long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    const int stop_fd = eventfd(0, EFD_NONBLOCK);
+    // Los mensajes por paquete (-v) pasan por el registro en memoria
+    if (log_start(stdout) < 0)
+    {
+        printf("[-] No se pudo iniciar el registro; los mensajes saldrán directo.\n");
+    }
+
+    Server* const servers = calloc(workers, sizeof *servers);
+    pthread_t* const threads = calloc(workers, sizeof *threads);
+    FileCache* const cache = cache_mib > 0 ? calloc(1, sizeof *cache) : NULL;
+    if (stop_fd < 0 || servers == NULL || threads == NULL || (cache_mib > 0 && cache == NULL))
+    {
+        printf("[-] No se pudo iniciar el servidor (%s).\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (cache != NULL)
+    {
+        pthread_mutex_init(&cache->lock, NULL);
+        cache->limit = (size_t)cache_mib << 20;
+    }
+
+    for (long i = 0; i < workers; i++)
+    {
+        Server* const server = &servers[i];
+        server->mode = mode;
+        server->window_size = (uint32_t)window_size;
+        server->max_payload = (size_t)max_payload;
+        server->initial_rto_us = timeout_val * 1000L;
+        server->shortest_rto_us = server->initial_rto_us;
+        server->e_percent = e_percent;
+        server->stop_fd = stop_fd;
+        server->zerocopy = zerocopy;
+        server->cc_ops = cc_ops;
+        server->fec = fec;
+        server->compress = compress;
+        server->cache = cache;
+        server->huge_pages = huge_pages;
+        server->index = (int)i;
+        server->cpu = pin && cpu_count > 0 ? (int)(i % cpu_count) : -1;
+
+        if (!server_init(server, port) || pthread_create(&threads[i], NULL, worker_main, server) != 0)
+        {
+            printf("[-] No se pudo iniciar el worker %ld (%s).\n", i, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    printf("SERVIDOR ACTIVO EN EL PUERTO %d (%ld workers)\n", port, workers);
+
+    // El servidor siempre debe estar "escuchando", hasta recibir SIGINT o SIGTERM
+    int signal_number;
+    sigwait(&signals, &signal_number);
+
+    const uint64_t stop = 1;
+    if (write(stop_fd, &stop, sizeof stop) < 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+    for (long i = 0; i < workers; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    printf("[+] Servidor detenido.\n");
+    for (long i = 0; i < workers; i++)
+    {
+        print_stats(&servers[i]);
+        server_shutdown(&servers[i]);
+    }
+    if (cache != NULL)
+    {
+        printf("Caché de archivos: %zu archivos, %.1f MiB, %lu aciertos, %lu fallos, %lu invalidados.\n", cache->entries,
+               (double)cache->bytes / (1 << 20), cache->hits, cache->misses, cache->invalidated);
+        cache_destroy(cache);
+    }
+
+    free(servers);
+    free(threads);
+    close(stop_fd);
     return 0;
 }
@@ -0,0 +1,286 @@
+#ifndef __URING_H
+#define __URING_H
+
+// Escrituras asíncronas al archivo por io_uring, para que el ciclo de recepción no espere
+// al disco. uring_write() copia el cacho a uno de 'depth' buffers y encola su escritura;
+// uring_submit() se lo entrega todo al kernel con un solo io_uring_enter(). Se usan las
+// llamadas al sistema directamente, sin liburing; si uring_init() falla se usa pwrite().
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define uring_max_depth 64
+
+// una escritura en vuelo, para completarla si el kernel escribió de menos
+typedef struct {
+    int fd;
+    size_t length;
+    off_t offset;
+}
+UringPending;
+
+// un anillo pertenece a un solo hilo
+typedef struct {
+    int fd;
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    struct io_uring_sqe *sqes;
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    unsigned char *buffers;
+    size_t buffer_size;
+    unsigned int depth;
+    bool fixed;                // buffers registrados en el anillo (IORING_OP_WRITE_FIXED)
+    UringPending pending[uring_max_depth];
+    unsigned int free_list[uring_max_depth];
+    unsigned int free_count;
+    unsigned int queued;       // SQEs aún sin entregar
+    int error;                 // la primera escritura fallida, como -errno
+}
+Uring;
+
+// declaraciones de funciones
+int uring_init(Uring *ring, unsigned int depth, size_t buffer_size);
+int uring_write(Uring *ring, int fd, const void *data, size_t length, off_t offset);
+int uring_submit(Uring *ring);
+int uring_flush(Uring *ring);
+void uring_exit(Uring *ring);
+
+static int uring_enter(Uring *ring, unsigned int submit, unsigned int wait)
+{
+    int ret;
+    do
+    {
+        ret = (int)syscall(__NR_io_uring_enter, ring->fd, submit, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+// recoge las escrituras ya terminadas y libera sus buffers; una escritura corta se
+// completa con pwrite()
+static void uring_reap(Uring *ring)
+{
+    unsigned int head = *ring->cq_head;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        const unsigned int index = (unsigned int)cqe->user_data;
+        const UringPending *pending = &ring->pending[index];
+        size_t done = cqe->res > 0 ? (size_t)cqe->res : 0;
+
+        if (cqe->res < 0 && ring->error == 0)
+        {
+            ring->error = cqe->res;
+        }
+        while (cqe->res >= 0 && done < pending->length)
+        {
+            const ssize_t bytes = pwrite(pending->fd, ring->buffers + index * ring->buffer_size + done,
+                                         pending->length - done, pending->offset + (off_t)done);
+            if (bytes <= 0)
+            {
+                ring->error = ring->error == 0 ? -EIO : ring->error;
+                break;
+            }
+            done += (size_t)bytes;
+        }
+        ring->free_list[ring->free_count++] = index;
+        head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Prepara el anillo y sus buffers. Registrar los buffers cuenta contra RLIMIT_MEMLOCK;
+// si no se puede se usan igual con IORING_OP_WRITE. Falla en kernels sin io_uring
+int uring_init(Uring *ring, unsigned int depth, size_t buffer_size)
+{
+    struct io_uring_params params;
+    struct iovec iovecs[uring_max_depth];
+
+    memset(ring, 0, sizeof *ring);
+    memset(&params, 0, sizeof params);
+    ring->fd = -1;
+    depth = depth < uring_max_depth ? depth : uring_max_depth;
+    if (depth == 0 || buffer_size == 0)
+    {
+        return -1;
+    }
+
+    ring->fd = (int)syscall(__NR_io_uring_setup, depth, &params);
+    if (ring->fd < 0)
+    {
+        return -1;
+    }
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->sq_map_size = ring->cq_map_size = ring->sq_map_size > ring->cq_map_size ? ring->sq_map_size : ring->cq_map_size;
+    }
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED)
+    {
+        goto fail;
+    }
+    ring->cq_map = params.features & IORING_FEAT_SINGLE_MMAP ? ring->sq_map :
+                   mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_map == MAP_FAILED)
+    {
+        goto fail;
+    }
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        goto fail;
+    }
+
+    ring->sq_head = (unsigned int *)((char *)ring->sq_map + params.sq_off.head);
+    ring->sq_tail = (unsigned int *)((char *)ring->sq_map + params.sq_off.tail);
+    ring->sq_mask = (unsigned int *)((char *)ring->sq_map + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *)((char *)ring->sq_map + params.sq_off.array);
+    ring->cq_head = (unsigned int *)((char *)ring->cq_map + params.cq_off.head);
+    ring->cq_tail = (unsigned int *)((char *)ring->cq_map + params.cq_off.tail);
+    ring->cq_mask = (unsigned int *)((char *)ring->cq_map + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_map + params.cq_off.cqes);
+
+    // No hay más escrituras en vuelo que SQEs, así que un buffer libre siempre tiene su SQE
+    ring->depth = depth < params.sq_entries ? depth : params.sq_entries;
+    ring->buffer_size = buffer_size;
+    ring->buffers = mmap(NULL, ring->depth * buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->buffers == MAP_FAILED)
+    {
+        ring->buffers = NULL;
+        goto fail;
+    }
+    for (unsigned int i = 0; i < ring->depth; i++)
+    {
+        iovecs[i].iov_base = ring->buffers + i * buffer_size;
+        iovecs[i].iov_len = buffer_size;
+        ring->free_list[i] = ring->depth - 1 - i;
+    }
+    ring->free_count = ring->depth;
+    ring->fixed = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iovecs, ring->depth) == 0;
+    return 0;
+
+fail:
+    uring_exit(ring);
+    return -1;
+}
+
+// Copia 'data' a un buffer libre y encola su escritura en 'offset'; si todos están en
+// vuelo espera a que termine alguno. Regresa el error de una escritura anterior, si hubo
+int uring_write(Uring *ring, int fd, const void *data, size_t length, off_t offset)
+{
+    if (length > ring->buffer_size)
+    {
+        return -EINVAL;
+    }
+    uring_reap(ring);
+    while (ring->free_count == 0 && ring->error == 0)
+    {
+        if (uring_enter(ring, ring->queued, 1) < 0)
+        {
+            ring->error = -errno;
+            break;
+        }
+        ring->queued = 0;
+        uring_reap(ring);
+    }
+    if (ring->error != 0)
+    {
+        return ring->error;
+    }
+
+    const unsigned int index = ring->free_list[--ring->free_count];
+    memcpy(ring->buffers + index * ring->buffer_size, data, length);
+    ring->pending[index] = (UringPending){fd, length, offset};
+
+    const unsigned int tail = *ring->sq_tail;
+    struct io_uring_sqe *const sqe = &ring->sqes[tail & *ring->sq_mask];
+    memset(sqe, 0, sizeof *sqe);
+    sqe->opcode = ring->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)(ring->buffers + index * ring->buffer_size);
+    sqe->len = (uint32_t)length;
+    sqe->off = (uint64_t)offset;
+    sqe->buf_index = (uint16_t)index;
+    sqe->user_data = index;
+    ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+    return 0;
+}
+
+// entrega las escrituras encoladas sin esperarlas; una vez por lote recibido
+int uring_submit(Uring *ring)
+{
+    if (ring->queued > 0)
+    {
+        if (uring_enter(ring, ring->queued, 0) < 0 && ring->error == 0)
+        {
+            ring->error = -errno;
+        }
+        ring->queued = 0;
+    }
+    uring_reap(ring);
+    return ring->error;
+}
+
+// espera a que terminen todas las escrituras, p. ej. antes de volver a leer el archivo
+int uring_flush(Uring *ring)
+{
+    uring_submit(ring);
+    while (ring->free_count < ring->depth)
+    {
+        if (uring_enter(ring, 0, 1) < 0)
+        {
+            ring->error = ring->error == 0 ? -errno : ring->error;
+            break;
+        }
+        uring_reap(ring);
+    }
+    return ring->error;
+}
+
+void uring_exit(Uring *ring)
+{
+    if (ring->buffers != NULL)
+    {
+        munmap(ring->buffers, ring->depth * ring->buffer_size);
+    }
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+    {
+        munmap(ring->sqes, (*ring->sq_mask + 1) * sizeof(struct io_uring_sqe));
+    }
+    if (ring->cq_map != NULL && ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map)
+    {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (ring->sq_map != NULL && ring->sq_map != MAP_FAILED)
+    {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+    if (ring->fd >= 0)
+    {
+        close(ring->fd);
+    }
+    memset(ring, 0, sizeof *ring);
+    ring->fd = -1;
+}
+
+#endif